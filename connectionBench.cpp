@@ -0,0 +1,221 @@
+#include <iostream>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "protocol.hpp"
+
+using boost::asio::ip::tcp;
+using std::string;
+using std::cout;
+using std::vector;
+using std::unique_ptr;
+
+// Idle connection benchmark: opens connections to the server in batches and keeps them open and idle,
+// printing after every batch the accept rate (connect -> welcome message received) and the server's
+// resident memory and open fds, so the per connection footprint can be read off directly.
+// With --storm it instead measures a reconnect storm: all connections are opened at once, as when
+// every client reconnects at market open, and dropped again, for a number of rounds.
+
+// PID of the first process named name, 0 if none
+int findProcess(const string& name)
+{
+    DIR* proc = opendir("/proc");
+    if (!proc) return 0;
+    int pid = 0;
+    while (dirent* entry = readdir(proc)) {
+        int candidate = std::atoi(entry->d_name);
+        if (candidate <= 0) continue;
+        std::ifstream comm("/proc/" + string(entry->d_name) + "/comm");
+        string processName;
+        if (std::getline(comm, processName) && processName == name) {
+            pid = candidate;
+            break;
+        }
+    }
+    closedir(proc);
+    return pid;
+}
+
+// VmRSS of pid in kB
+long residentKb(int pid)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmRSS:") == 0) return std::atol(line.c_str() + 6);
+    return 0;
+}
+
+long openFds(int pid)
+{
+    DIR* fds = opendir(("/proc/" + std::to_string(pid) + "/fd").c_str());
+    if (!fds) return 0;
+    long count = 0;
+    while (dirent* entry = readdir(fds))
+        if (entry->d_name[0] != '.') count++;
+    closedir(fds);
+    return count;
+}
+
+// Source address for the n-th connection: connect() only uses half the ephemeral port range per source
+// address and slows down badly as that half fills up, so spread over 127.0.0.2, .3, ...
+uint32_t sourceAddress(size_t n)
+{
+    return 0x7f000002 + static_cast<uint32_t>(n / 10000);
+}
+
+// Opens connections non-blocking all at once, then waits until every one has its welcome message.
+// Connections are closed with a reset, so no TIME_WAIT is left behind between rounds.
+int storm(int connections, int rounds)
+{
+    int epollFd = epoll_create1(0);
+    vector<int> fds(connections);
+    vector<int64_t> started(connections);
+    vector<size_t> received(connections);
+    vector<int64_t> latencies;
+    vector<epoll_event> events(1024);
+    cout << "Round\tConnections\tFailed\tAccepts/s\tWelcome p50 us\tp99 us\tmax us\n";
+
+    for (int round = 1; round <= rounds; round++) {
+        latencies.clear();
+        int pending = 0, failed = 0;
+        int64_t start = nowNs();
+        for (int i = 0; i < connections; i++) {
+            fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int noPort = 1;
+            setsockopt(fds[i], IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &noPort, sizeof(noPort));
+            sockaddr_in source{}, server{};
+            source.sin_family = server.sin_family = AF_INET;
+            source.sin_addr.s_addr = htonl(sourceAddress(i));
+            server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            server.sin_port = htons(8080);
+            started[i] = nowNs();
+            received[i] = 0;
+            if (fds[i] < 0 || bind(fds[i], reinterpret_cast<sockaddr*>(&source), sizeof(source)) < 0 ||
+                (connect(fds[i], reinterpret_cast<sockaddr*>(&server), sizeof(server)) < 0 && errno != EINPROGRESS)) {
+                if (fds[i] >= 0) close(fds[i]);
+                fds[i] = -1;
+                failed++;
+                continue;
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u32 = i;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &event);
+            pending++;
+        }
+
+        while (pending > 0) {
+            // SYNs dropped on a full backlog are only retransmitted after a second, so allow for a few
+            int ready = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), 10000);
+            if (ready <= 0) break;
+            for (int e = 0; e < ready; e++) {
+                int i = events[e].data.u32;
+                Order welcome;
+                ssize_t bytes = recv(fds[i], reinterpret_cast<char*>(&welcome) + received[i], sizeof(welcome) - received[i], 0);
+                if (bytes > 0) received[i] += bytes;
+                else if (bytes < 0 && errno == EAGAIN) continue;
+                if (bytes <= 0) failed++;
+                else if (received[i] < sizeof(welcome)) continue;
+                else latencies.push_back(nowNs() - started[i]);
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fds[i], nullptr);
+                pending--;
+            }
+        }
+        double seconds = (nowNs() - start) / 1e9;
+        failed += pending;
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))] / 1000.0;
+        };
+        printf("%d\t%zu\t\t%d\t%.0f\t\t%.0f\t\t%.0f\t%.0f\n", round, latencies.size(), failed, latencies.size() / seconds,
+               percentile(0.5), percentile(0.99), percentile(1.0));
+        fflush(stdout);
+
+        linger reset{1, 0};
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+            close(fd);
+        }
+        sleep(1); // Let the server tear the sessions down before the next storm
+    }
+    close(epollFd);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2 && string(argv[1]) == "--storm") return storm(std::atoi(argv[2]), argc > 3 ? std::atoi(argv[3]) : 5);
+    if (argc < 2) {
+        cout << "Usage: connectionBench <connections> [batch, default 10000] [server name, default serverplus]\n";
+        cout << "       connectionBench --storm <connections> [rounds, default 5]\n";
+        return 1;
+    }
+    int connections = std::atoi(argv[1]);
+    int batch = argc > 2 ? std::atoi(argv[2]) : 10000;
+    string serverName = argc > 3 ? argv[3] : "serverplus";
+
+    int serverPid = findProcess(serverName);
+    if (!serverPid) {
+        cout << "No running " << serverName << " process\n";
+        return 1;
+    }
+
+    boost::asio::io_service ioService;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 8080);
+    vector<unique_ptr<tcp::socket>> sockets;
+    sockets.reserve(connections);
+
+    long baseRss = residentKb(serverPid);
+    long baseFds = openFds(serverPid);
+    cout << "Server " << serverName << " (pid " << serverPid << "): " << baseRss << " kB RSS, " << baseFds << " fds before connecting\n";
+    cout << "Connections\tAccepts/s\tRSS kB\tfds\tRSS per 10k kB\tbytes/conn\n";
+
+    while (static_cast<int>(sockets.size()) < connections) {
+        int count = std::min(batch, connections - static_cast<int>(sockets.size()));
+        size_t before = sockets.size();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            unique_ptr<tcp::socket> socket(new tcp::socket(ioService, tcp::v4()));
+            int noPort = 1;
+            setsockopt(socket->native_handle(), IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &noPort, sizeof(noPort));
+            boost::system::error_code error;
+            socket->bind(tcp::endpoint(boost::asio::ip::address_v4(sourceAddress(sockets.size())), 0), error);
+            if (!error) socket->connect(endpoint, error);
+            Order welcome;
+            if (!error) boost::asio::read(*socket, boost::asio::buffer(&welcome, sizeof(welcome)), error);
+            if (error) {
+                cout << "Connection " << sockets.size() + 1 << " failed: " << error.message() << "\n";
+                connections = static_cast<int>(sockets.size());
+                break;
+            }
+            sockets.push_back(std::move(socket));
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (sockets.empty()) break;
+
+        long rss = residentKb(serverPid);
+        long fds = openFds(serverPid);
+        double perConnection = static_cast<double>(rss - baseRss) * 1024 / sockets.size();
+        printf("%zu\t\t%.0f\t\t%ld\t%ld\t%.0f\t\t%.0f\n", sockets.size(), (sockets.size() - before) / seconds, rss, fds,
+               perConnection * 10000 / 1024, perConnection);
+        fflush(stdout);
+    }
+
+    cout << "Holding " << sockets.size() << " idle connections, press Enter to close them\n";
+    std::cin.get();
+    return 0;
+}
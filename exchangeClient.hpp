@@ -0,0 +1,387 @@
+#ifndef EXCHANGE_CLIENT_HPP
+#define EXCHANGE_CLIENT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "latencyStats.hpp"
+#include "memoryPool.hpp"
+#include "orderSession.hpp"
+#include "protocol.hpp"
+
+// Client library for strategy processes: one thread calls poll() in its loop, which sends what was queued
+// and turns the reports that have arrived into callbacks, never blocking on the exchange. Orders are
+// tracked in a flat slab table; their order IDs are handed out by the library and lead straight to their
+// slot, so neither sending nor handling a report touches the heap once the table has grown to the number
+// of orders the client keeps open.
+
+// Where an order of this client is
+enum OrderState : char {
+    OrderPending = 'P',          // Sent, not acknowledged yet
+    OrderWorking = 'W',          // Acknowledged, nothing filled yet (a stop order: waiting for its trigger)
+    OrderPartiallyFilled = 'F',
+    OrderFilled = 'D',           // Filled completely
+    OrderCancelled = 'C',        // Cancelled with quantity left: reason says why (0 = by the client or its execution)
+    OrderRejected = 'R',         // Not accepted: reason holds the RejectReason, X if the exchange found it invalid
+};
+
+struct ClientOrder {
+    int orderId;
+    int symbol;
+    char type;        // B or S
+    char execution;
+    char state;       // OrderState
+    char reason;
+    double price;
+    int quantity;     // Ordered, less what self-trade prevention decremented
+    int filled;
+    double filledNotional;
+    int64_t sendTs;   // nowNs() when it was queued
+
+    double averagePrice() const { return filled ? filledNotional / filled : 0; }
+    bool done() const { return state == OrderFilled || state == OrderCancelled || state == OrderRejected; }
+};
+
+// Callbacks, all made from poll() on the thread calling it. The ClientOrder passed in already reflects the
+// report; an order that is done is gone from the table once its callback returns.
+class ClientHandler {
+public:
+    virtual void onAck(const ClientOrder&) {}
+    virtual void onFill(const ClientOrder&, const Order& /*fill*/) {}
+    virtual void onCancel(const ClientOrder&, const Order& /*report*/) {}  // C, or D: decremented, still working
+    virtual void onReject(const ClientOrder&, const Order& /*report*/) {}
+    virtual void onTriggered(const ClientOrder&) {}
+    // Everything else: welcome, login, mass cancel and mass quote answers, fills and rejects of quotes
+    virtual void onReport(const Order&) {}
+
+protected:
+    ~ClientHandler() {}
+};
+
+// Handler printing every report the way the bundled clients show them
+class ConsoleHandler : public ClientHandler {
+public:
+    void onAck(const ClientOrder& order) override
+    {
+        std::cout << "Order Placed! OrderId: " << order.orderId << "\n";
+    }
+
+    void onFill(const ClientOrder& order, const Order&) override
+    {
+        std::cout << "OrderId: " << order.orderId << " | " << order.filled << "/" << order.quantity
+                  << " Avg. Price: " << std::to_string(order.averagePrice())
+                  << (order.state == OrderFilled ? " [Completed]\n" : " [Partially Filled]\n");
+    }
+
+    void onCancel(const ClientOrder& order, const Order& report) override
+    {
+        if (report.type == 'D') {
+            std::cout << "OrderId: " << order.orderId << " Decremented by " << report.quantity << " ("
+                      << rejectReasonText(report.reason) << ")\n";
+            return;
+        }
+        std::cout << "OrderId: " << order.orderId << " Cancelled, " << report.quantity << " unfilled";
+        if (report.reason) std::cout << " (" << rejectReasonText(report.reason) << ")";
+        std::cout << "\n";
+    }
+
+    void onReject(const ClientOrder&, const Order& report) override
+    {
+        printReject(report);
+    }
+
+    void onTriggered(const ClientOrder& order) override
+    {
+        std::cout << "Stop Triggered! OrderId: " << order.orderId << "\n";
+    }
+
+    void onReport(const Order& report) override
+    {
+        switch (report.type) {
+        case 'W':
+            std::cout << "Welcome! You are ClientID " << report.clientId << "\n";
+            break;
+        case 'L':
+            std::cout << "Logged in as " << report.orderId << " (ClientID " << report.clientId << "), "
+                      << report.quantity << " missed reports replayed\n";
+            break;
+        case 'M':
+            std::cout << "Mass Cancel: " << report.quantity << " orders cancelled\n";
+            break;
+        case 'Q':
+            std::cout << "Mass Quote: " << report.quantity << " bids and asks quoted, " << report.displayQuantity
+                      << " previous quotes replaced\n";
+            break;
+        case 'B':
+        case 'S':
+            std::cout << "Quote OrderId: " << report.orderId << (report.type == 'B' ? " bought " : " sold ")
+                      << report.quantity << " @ " << std::to_string(report.price) << "\n";
+            break;
+        case 'X':
+        case 'O':
+        case 'R':
+            printReject(report);
+            break;
+        default:
+            break;
+        }
+    }
+
+private:
+    static void printReject(const Order& report)
+    {
+        if (report.type == 'X') std::cout << "Invalid Order\n";
+        else if (report.type == 'O') std::cout << "Price Rejected by Exchange: " << rejectReasonText(report.reason) << "\n";
+        else std::cout << "Rejected by Risk Checks: " << rejectReasonText(report.reason) << "\n";
+    }
+};
+
+class ExchangeClient {
+public:
+    // Order IDs are (generation << kSlotBits) | slot, slot indexing the order table. Quote entries get IDs
+    // with kQuoteBit set, so their fills are told apart from those of orders.
+    static const int kSlotBits = 20;   // Open orders at most
+    static const int kGenerationMask = (1 << (30 - kSlotBits)) - 1;
+    static const int kQuoteBit = 1 << 30;
+    static const size_t kOutbox = 1024; // Messages queued between polls before send() pushes them out itself
+
+    // expectedOrders: open orders to make room for up front
+    ExchangeClient(std::unique_ptr<OrderSession> session, ClientHandler& handler, size_t expectedOrders = 4096)
+        : session_(std::move(session)), handler_(handler), orders_(expectedOrders)
+    {
+        generations_.reserve(orders_.capacity());
+        outbox_.reserve(kOutbox);
+    }
+
+    // Queue a new order: type, symbol, price and quantity set, optionally execution, displayQuantity,
+    // stopPrice, expireTime and selfTrade. Returns its order ID.
+    int send(const Order& order)
+    {
+        uint32_t slot = orders_.allocate();
+        if (slot >> kSlotBits) {
+            orders_.release(slot);
+            throw std::length_error("Too many open orders");
+        }
+        if (generations_.capacity() <= slot) generations_.reserve(orders_.capacity());
+        int& generation = generations_[slot];
+        generation = generation % kGenerationMask + 1;
+
+        Order message(order);
+        message.orderId = (generation << kSlotBits) | static_cast<int>(slot);
+        message.clientSendTs = nowNs();
+
+        ClientOrder& tracked = orders_[slot];
+        tracked = ClientOrder{};
+        tracked.orderId = message.orderId;
+        tracked.symbol = order.symbol;
+        tracked.type = order.type;
+        tracked.execution = order.execution;
+        tracked.state = OrderPending;
+        tracked.price = order.price;
+        tracked.quantity = order.quantity;
+        tracked.sendTs = message.clientSendTs;
+        open_++;
+        queue(message);
+        return message.orderId;
+    }
+
+    // Cancel the open orders of one symbol (-1 = all) and side (0 = both); each reports through onCancel
+    void cancelAll(int symbol = -1, char side = 0)
+    {
+        Order message{};
+        message.type = 'M';
+        message.symbol = symbol;
+        message.side = side;
+        message.clientSendTs = nowNs();
+        queue(message);
+    }
+
+    // Replace all of the client's quotes with these two sided entries (type, orderId and clientId are set
+    // here, see Order for the rest); none pulls them. Entries get consecutive quote IDs, the first returned.
+    int massQuote(const Order* entries, size_t count)
+    {
+        Order header{};
+        header.type = 'Q';
+        header.orderId = kQuoteBit | static_cast<int>(++quotes_ & (kQuoteBit - 1));
+        header.quantity = static_cast<int>(count);
+        header.clientSendTs = nowNs();
+        queue(header);
+        int first = 0;
+        for (size_t i = 0; i < count; i++) {
+            Order entry(entries[i]);
+            entry.type = 'q';
+            entry.orderId = kQuoteBit | static_cast<int>(++quotes_ & (kQuoteBit - 1));
+            if (i == 0) first = entry.orderId;
+            queue(entry);
+        }
+        return first;
+    }
+
+    // Push queued messages out as far as the transport takes them without blocking, then handle every
+    // report that has arrived. With a timeout and nothing arrived yet, first waits up to that long for
+    // reports (or for room to send), which TCP sessions do in the kernel. Returns the number of reports handled.
+    size_t poll(int timeoutMs = 0)
+    {
+        flush();
+        size_t handled = receive();
+        if (handled == 0 && timeoutMs > 0) {
+            session_->wait(timeoutMs, pendingSends());
+            flush();
+            handled = receive();
+        }
+        return handled;
+    }
+
+    // Open order by ID, nullptr if it is done or unknown
+    const ClientOrder* find(int orderId) const
+    {
+        if (orderId <= 0 || (orderId & kQuoteBit)) return nullptr;
+        uint32_t slot = static_cast<uint32_t>(orderId) & ((1u << kSlotBits) - 1);
+        if (slot >= orders_.capacity() || orders_[slot].orderId != orderId || orders_[slot].done()) return nullptr;
+        return &orders_[slot];
+    }
+
+    size_t openOrders() const { return open_; }
+    bool pendingSends() const { return sent_ < outbox_.size(); }
+
+    // Latency breakdown built from the timestamps echoed by the exchange
+    void printLatencyStats() const
+    {
+        std::printf("--------------------------------\n");
+        std::printf("Latency Stats-------------------\n");
+        wireLatency_.print("wire-to-wire");
+        serverLatency_.print("server internal");
+        networkLatency_.print("network+kernel");
+    }
+
+    // Acks and rejects of our own messages so far
+    uint64_t acknowledged() const { return wireLatency_.count(); }
+
+private:
+    std::unique_ptr<OrderSession> session_;
+    ClientHandler& handler_;
+    SlabPool<ClientOrder> orders_;
+    SlabArray<int> generations_;  // By slot: generation of its latest order ID
+    size_t open_ = 0;
+    uint32_t quotes_ = 0;
+    std::vector<Order> outbox_;   // Queued messages, [sent_, end) not handed over yet
+    size_t sent_ = 0;
+
+    LatencyHistogram wireLatency_;     // Wire to wire: order sent -> ack/reject received
+    LatencyHistogram serverLatency_;   // Server internal: ingress -> egress, for every report
+    LatencyHistogram networkLatency_;  // Wire to wire minus server internal: network + kernel on both hosts
+
+    void queue(const Order& message)
+    {
+        if (outbox_.size() == kOutbox) {
+            flush();
+            if (outbox_.size() == kOutbox) { // The exchange is not keeping up: wait for the transport
+                session_->sendBatch(outbox_.data() + sent_, outbox_.size() - sent_);
+                outbox_.clear();
+                sent_ = 0;
+            }
+        }
+        outbox_.push_back(message);
+    }
+
+    void flush()
+    {
+        if (sent_ < outbox_.size()) sent_ += session_->trySend(outbox_.data() + sent_, outbox_.size() - sent_);
+        if (sent_ == outbox_.size()) {
+            outbox_.clear();
+            sent_ = 0;
+        }
+    }
+
+    size_t receive()
+    {
+        size_t handled = 0;
+        Order report;
+        while (session_->tryReceive(report)) {
+            onReport(report, nowNs());
+            handled++;
+        }
+        return handled;
+    }
+
+    ClientOrder* lookup(int orderId)
+    {
+        return const_cast<ClientOrder*>(find(orderId));
+    }
+
+    void release(ClientOrder& order)
+    {
+        orders_.release(static_cast<uint32_t>(order.orderId) & ((1u << kSlotBits) - 1));
+        open_--;
+    }
+
+    void onReport(const Order& report, int64_t receivedTs)
+    {
+        recordLatency(report, receivedTs);
+        ClientOrder* order = report.type == 'W' || report.type == 'L' ? nullptr : lookup(report.orderId); // L: orderId is the login
+        if (!order) {
+            handler_.onReport(report);
+            return;
+        }
+
+        switch (report.type) {
+        case 'A':
+            order->state = OrderWorking;
+            handler_.onAck(*order);
+            return;
+        case 'T':
+            handler_.onTriggered(*order);
+            return;
+        case 'B':
+        case 'S':
+            order->filled += report.quantity;
+            order->filledNotional += report.price * report.quantity;
+            order->state = order->filled >= order->quantity ? OrderFilled : OrderPartiallyFilled;
+            handler_.onFill(*order, report);
+            break;
+        case 'D':
+            order->quantity -= report.quantity;
+            if (order->filled >= order->quantity) order->state = OrderFilled;
+            handler_.onCancel(*order, report);
+            break;
+        case 'C':
+            order->state = OrderCancelled;
+            order->reason = report.reason;
+            handler_.onCancel(*order, report);
+            break;
+        case 'X':
+        case 'O':
+        case 'R':
+            order->state = OrderRejected;
+            order->reason = report.type == 'X' ? 'X' : report.reason;
+            handler_.onReject(*order, report);
+            break;
+        default:
+            handler_.onReport(report);
+            return;
+        }
+        if (order->done()) release(*order);
+    }
+
+    void recordLatency(const Order& report, int64_t receivedTs)
+    {
+        if (report.serverRecvTs == 0 || report.serverSendTs == 0) return;
+
+        int64_t serverTime = report.serverSendTs - report.serverRecvTs;
+        serverLatency_.record(serverTime);
+
+        // Acks and rejects answer our own send directly, fills may be triggered by another client's order
+        if (report.clientSendTs != 0 && (report.type == 'A' || report.type == 'Q' || report.type == 'X' || report.type == 'O' ||
+                                         report.type == 'R')) {
+            int64_t wireTime = receivedTs - report.clientSendTs;
+            wireLatency_.record(wireTime);
+            networkLatency_.record(wireTime - serverTime);
+        }
+    }
+};
+
+#endif // EXCHANGE_CLIENT_HPP
@@ -0,0 +1,212 @@
+#ifndef IO_URING_HPP
+#define IO_URING_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Thin io_uring wrapper on the raw syscalls (no liburing dependency).
+// Single issuer: one thread prepares SQEs, submits and reaps CQEs.
+class IoUring {
+public:
+    IoUring() {}
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring()
+    {
+        if (bufferRing_) munmap(bufferRing_, bufferRingBytes_);
+        if (sqes_) munmap(sqes_, sqesBytes_);
+        if (cqRing_ && cqRing_ != sqRing_) munmap(cqRing_, cqRingBytes_);
+        if (sqRing_) munmap(sqRing_, sqRingBytes_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    // Returns false (errno set) if the kernel has no usable io_uring
+    bool init(unsigned entries, unsigned cqEntries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+        params.cq_entries = cqEntries;
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0 && errno == EINVAL) {
+            // Older kernel without SINGLE_ISSUER / COOP_TASKRUN
+            params.flags = IORING_SETUP_CQSIZE;
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        }
+        if (fd_ < 0) return false;
+        if (!(params.features & IORING_FEAT_NODROP)) {
+            errno = ENOTSUP;
+            return false;
+        }
+
+        sqRingBytes_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cqRingBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            if (cqRingBytes_ > sqRingBytes_) sqRingBytes_ = cqRingBytes_;
+            cqRingBytes_ = sqRingBytes_;
+        }
+        sqRing_ = mapRing(sqRingBytes_, IORING_OFF_SQ_RING);
+        if (!sqRing_) return false;
+        cqRing_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing_ : mapRing(cqRingBytes_, IORING_OFF_CQ_RING);
+        if (!cqRing_) return false;
+        sqesBytes_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mapRing(sqesBytes_, IORING_OFF_SQES));
+        if (!sqes_) return false;
+
+        char* sq = static_cast<char*>(sqRing_);
+        sqHead_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        sqEntries_ = params.sq_entries;
+        uint32_t* array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        for (uint32_t i = 0; i < sqEntries_; i++) array[i] = i; // Fixed 1:1 SQE mapping
+
+        char* cq = static_cast<char*>(cqRing_);
+        cqHead_ = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        localTail_ = sqTail_->load(std::memory_order_relaxed);
+        return true;
+    }
+
+    // Next free SQE (zeroed), submitting what is queued first if the ring is full
+    io_uring_sqe* getSqe()
+    {
+        if (localTail_ - sqHead_->load(std::memory_order_acquire) >= sqEntries_) {
+            submit(0);
+            if (localTail_ - sqHead_->load(std::memory_order_acquire) >= sqEntries_) return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes_[localTail_ & sqMask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        localTail_++;
+        return sqe;
+    }
+
+    // One syscall for every SQE prepared since the last call, optionally waiting for completions.
+    // poll enters the kernel even with nothing to submit or wait for: with COOP_TASKRUN completions are
+    // only posted from inside io_uring_enter, so a busy polling loop has to call in every iteration.
+    int submit(unsigned waitFor, bool poll = false)
+    {
+        uint32_t toSubmit = localTail_ - sqTail_->load(std::memory_order_relaxed);
+        sqTail_->store(localTail_, std::memory_order_release);
+        if (toSubmit == 0 && waitFor == 0 && !poll) return 0;
+        int submitted;
+        do {
+            submitted = static_cast<int>(syscall(__NR_io_uring_enter, fd_, toSubmit, waitFor,
+                                                 (waitFor || poll) ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        } while (submitted < 0 && errno == EINTR);
+        return submitted;
+    }
+
+    // Calls handler(const io_uring_cqe&) for every completion available, returns how many
+    template<typename Handler>
+    unsigned reap(Handler&& handler)
+    {
+        uint32_t head = cqHead_->load(std::memory_order_relaxed);
+        uint32_t tail = cqTail_->load(std::memory_order_acquire);
+        unsigned count = 0;
+        while (head != tail) {
+            handler(cqes_[head & cqMask_]);
+            head++;
+            count++;
+            cqHead_->store(head, std::memory_order_release); // Free the slot before the handler can queue more
+            if (head == tail) tail = cqTail_->load(std::memory_order_acquire);
+        }
+        return count;
+    }
+
+    // Provided buffer ring for multishot receives: count buffers of size bytes in group groupId
+    bool setupBufferRing(uint16_t groupId, unsigned count, unsigned size)
+    {
+        bufferCount_ = count;
+        bufferSize_ = size;
+        bufferGroup_ = groupId;
+        bufferRingBytes_ = count * sizeof(io_uring_buf);
+        void* ring = mmap(nullptr, bufferRingBytes_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring == MAP_FAILED) return false;
+        bufferRing_ = static_cast<io_uring_buf_ring*>(ring);
+
+        io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufferRing_);
+        reg.ring_entries = count;
+        reg.bgid = groupId;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+        buffers_.resize(static_cast<size_t>(count) * size);
+        bufferTail_ = 0;
+        for (unsigned id = 0; id < count; id++) addBuffer(static_cast<uint16_t>(id));
+        publishBuffers();
+        return true;
+    }
+
+    uint16_t bufferGroup() const { return bufferGroup_; }
+    const char* buffer(uint16_t id) const { return &buffers_[static_cast<size_t>(id) * bufferSize_]; }
+
+    // Give a consumed buffer back to the kernel (visible after publishBuffers)
+    void recycleBuffer(uint16_t id)
+    {
+        addBuffer(id);
+    }
+
+    void publishBuffers()
+    {
+        reinterpret_cast<std::atomic<uint16_t>*>(&bufferRing_->tail)->store(bufferTail_, std::memory_order_release);
+    }
+
+private:
+    int fd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqRingBytes_ = 0;
+    size_t cqRingBytes_ = 0;
+    size_t sqesBytes_ = 0;
+
+    std::atomic<uint32_t>* sqHead_ = nullptr;
+    std::atomic<uint32_t>* sqTail_ = nullptr;
+    uint32_t sqMask_ = 0;
+    uint32_t sqEntries_ = 0;
+    uint32_t localTail_ = 0;  // SQEs prepared, published to the kernel on submit
+
+    std::atomic<uint32_t>* cqHead_ = nullptr;
+    std::atomic<uint32_t>* cqTail_ = nullptr;
+    uint32_t cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    io_uring_buf_ring* bufferRing_ = nullptr;
+    size_t bufferRingBytes_ = 0;
+    unsigned bufferCount_ = 0;
+    unsigned bufferSize_ = 0;
+    uint16_t bufferGroup_ = 0;
+    uint16_t bufferTail_ = 0;
+    std::vector<char> buffers_;
+
+    void* mapRing(size_t bytes, off_t offset)
+    {
+        void* ring = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+
+    void addBuffer(uint16_t id)
+    {
+        // Index from the ring start: in C++ __DECLARE_FLEX_ARRAY puts bufs behind an empty struct, 8 bytes off
+        io_uring_buf& entry = reinterpret_cast<io_uring_buf*>(bufferRing_)[bufferTail_ & (bufferCount_ - 1)];
+        entry.addr = reinterpret_cast<uint64_t>(&buffers_[static_cast<size_t>(id) * bufferSize_]);
+        entry.len = bufferSize_;
+        entry.bid = id;
+        bufferTail_++;
+    }
+};
+
+#endif // IO_URING_HPP
@@ -0,0 +1,107 @@
+#ifndef LATENCY_STATS_HPP
+#define LATENCY_STATS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Fixed size log-linear latency histogram (nanoseconds).
+// Values are grouped by power of two and split into 16 linear sub-buckets, so any
+// percentile is accurate to ~6%. Recording is a few arithmetic ops and never allocates.
+class LatencyHistogram {
+public:
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void record(int64_t ns)
+    {
+        if (ns < 0) ns = 0;
+        buckets_[bucketIndex(static_cast<uint64_t>(ns))]++;
+        count_++;
+        sum_ += ns;
+        if (ns < min_) min_ = ns;
+        if (ns > max_) max_ = ns;
+    }
+
+    void reset()
+    {
+        for (uint64_t& bucket : buckets_) bucket = 0;
+        count_ = 0;
+        sum_ = 0;
+        min_ = INT64_MAX;
+        max_ = 0;
+    }
+
+    uint64_t count() const { return count_; }
+    int64_t min() const { return count_ ? min_ : 0; }
+    int64_t max() const { return max_; }
+    int64_t mean() const { return count_ ? sum_ / static_cast<int64_t>(count_) : 0; }
+
+    // Upper bound of the bucket holding the given percentile [0 - 100]
+    int64_t percentile(double p) const
+    {
+        if (count_ == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                int64_t upper = bucketUpperBound(i);
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    // One line summary, e.g. "ack RTT  n=1000 min=12.1us p50=15.3us p99=40.2us p99.9=80.0us max=95.1us"
+    void print(const std::string& name) const
+    {
+        std::printf("%-18s n=%-9llu min=%-9s p50=%-9s p99=%-9s p99.9=%-9s max=%-9s mean=%s\n", name.c_str(),
+                    static_cast<unsigned long long>(count_), format(min()).c_str(), format(percentile(50)).c_str(),
+                    format(percentile(99)).c_str(), format(percentile(99.9)).c_str(), format(max()).c_str(),
+                    format(mean()).c_str());
+    }
+
+private:
+    static const int kSubBits = 4;
+    static const int kSub = 1 << kSubBits;
+    static const int kBuckets = (64 - kSubBits + 1) * kSub;
+
+    uint64_t buckets_[kBuckets];
+    uint64_t count_;
+    int64_t sum_;
+    int64_t min_;
+    int64_t max_;
+
+    static int bucketIndex(uint64_t v)
+    {
+        if (v < kSub) return static_cast<int>(v);
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - kSubBits;
+        return (shift + 1) * kSub + static_cast<int>((v >> shift) & (kSub - 1));
+    }
+
+    static int64_t bucketUpperBound(int index)
+    {
+        if (index < kSub) return index;
+        int shift = index / kSub - 1;
+        uint64_t base = static_cast<uint64_t>(kSub + index % kSub) << shift;
+        return static_cast<int64_t>(base + (uint64_t(1) << shift) - 1);
+    }
+
+    static std::string format(int64_t ns)
+    {
+        char text[32];
+        if (ns < 1000)
+            std::snprintf(text, sizeof(text), "%lldns", static_cast<long long>(ns));
+        else if (ns < 1000000)
+            std::snprintf(text, sizeof(text), "%.1fus", ns / 1e3);
+        else
+            std::snprintf(text, sizeof(text), "%.2fms", ns / 1e6);
+        return text;
+    }
+};
+
+#endif // LATENCY_STATS_HPP
@@ -1,182 +1,125 @@
 #include <iostream>
 #include <boost/asio.hpp>
-#include <thread>
-#include <mutex>
 #include <ctime>
-#include <unordered_map>
-#include <memory>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include "protocol.hpp"
+#include "exchangeClient.hpp"
 
-using boost::asio::ip::tcp;
 using std::string;
-using std::cout;
-using std::cin;
-using std::getline;
 using std::stringstream;
-using std::to_string;
-using std::lock_guard;
-using std::mutex;
-using std::unordered_map;
-using std::shared_ptr;
-using std::make_shared;
-using std::time_t;
-using std::thread;
-
-struct Order {
-    int clientId;
-    int orderId;
-    char type;
-    double price;
-    int quantity;
-    time_t time;
-};
 
 class Client {
 public:
-    Client(boost::asio::io_service& ioService, const string& serverIP, short serverPort)
-        : socket_(ioService), serverIP_(serverIP), serverPort_(serverPort), isRunning_(true)
+    Client(boost::asio::io_service& ioService, const string& serverIP, short serverPort, bool shm, int login)
+        : client_(connectOrderSession(ioService, serverIP, serverPort, shm, login), handler_)
     {
-        connect();
     }
 
+    // One thread does it all: the exchange's reports as they arrive, the user's lines in between
     void run()
     {
-        // Start the receiving thread
-        thread receiveThread(&Client::receiveMessages, this);
-
-        // Run the main thread for user input and sending orders
-        while (isRunning_) {
-            readInput();
+        while (true) {
+            client_.poll(kPollMs);
+            pollfd input{STDIN_FILENO, POLLIN, 0};
+            if (inputOpen_ && ::poll(&input, 1, 0) > 0) readInput();
         }
-
-        // Wait for the receiving thread to finish
-        receiveThread.join();
     }
 
 private:
-    // Private members
-    tcp::socket socket_;
-    string serverIP_;
-    short serverPort_;
-    bool isRunning_;
-    mutex mutex_;
-    unordered_map<int, shared_ptr<Order>> orders_;
-    unordered_map<int, shared_ptr<Order>> filledOrders_;
+    static const int kPollMs = 10;  // Longest wait for reports before looking at the input again
 
-    // Private methods
-    void connect()
-    {
-        tcp::resolver resolver(socket_.get_io_service());
-        tcp::resolver::query query(serverIP_, to_string(serverPort_));
-        tcp::resolver::iterator endpointIterator = resolver.resolve(query);
-
-        boost::asio::connect(socket_, endpointIterator);
-    }
+    ConsoleHandler handler_;
+    ExchangeClient client_;
+    bool inputOpen_ = true;
+    string pendingInput_;  // Typed, up to the end of a line still to come
 
     void readInput()
     {
-        string input;
-        getline(cin, input);
-
-        if (!input.empty()) {
-            // Process the user input and send the order
-            Order order;
-            stringstream ss(input);
-            ss >> order.type >> order.price >> order.quantity;
-            order.orderId = generateOrderId();
-            orders_[order.orderId] = make_shared<Order>(order);
-            sendOrder(order);
+        char buffer[4096];
+        ssize_t size = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (size <= 0) {
+            inputOpen_ = false; // Keep showing reports
+            return;
         }
-    }
-
-    void sendOrder(const Order& order)
-    {
-        boost::asio::write(socket_, boost::asio::buffer(&order, sizeof(order)));
-    }
-
-    void receiveMessages()
-    {
-        while (isRunning_) {
-            Order order;
-            size_t bytesRead = socket_.read_some(boost::asio::buffer(&order, sizeof(order)));
-
-            // Acquire a lock to prevent interleaved output with user input
-            lock_guard<mutex> lock(mutex_);
-
-            // Interpret the received message
-            interpretReceivedMessage(order);
+        pendingInput_.append(buffer, size);
+        size_t end;
+        while ((end = pendingInput_.find('\n')) != string::npos) {
+            handleLine(pendingInput_.substr(0, end));
+            pendingInput_.erase(0, end + 1);
         }
     }
 
-    void interpretReceivedMessage(Order &order)
+    void handleLine(const string& input)
     {
-        int orderId = order.orderId;
-        switch(order.type) {
-            case 'X':
-                orders_.erase(orderId);
-                cout << "Invalid Order\n";
-                break;
-            case 'O':
-                orders_.erase(orderId);
-                cout << "Price Not in Range Set by Exchange\n";
-                break;
-            case 'W':
-                cout << "Welcome! You are ClientID " << to_string(order.clientId) << "\n";
-                break;
-            case 'A':
-                order.quantity = 0;
-                filledOrders_[orderId] = make_shared<Order>(order);
-                cout << "Order Placed! OrderId: " << to_string(orderId) << "\n";
-                break;
-            case 'B':
-            case 'S':
-                int quantity;
-                double price;
-                price = weightedAveragePrice(order, *filledOrders_[orderId]);
-                filledOrders_[orderId]->quantity += order.quantity;
-                filledOrders_[orderId]->price = price;
-
-                // Displaying result
-                cout << "OrderId: " << to_string(orderId) << " | ";
-                cout << to_string(filledOrders_[orderId]->quantity) << "/" << to_string(orders_[orderId]->quantity);
-                cout << " Avg. Price: " << to_string(filledOrders_[orderId]->price);
-
-                // Display Status and Clean OrderBook
-                if (filledOrders_[orderId]->quantity == orders_[orderId]->quantity) {
-                    orders_.erase(orderId);
-                    filledOrders_.erase(orderId);
-                    cout << " [Completed]\n";
-                }
-                else {
-                    cout << " [Partially Filled]\n";
+        if (input == "stats") {
+            client_.printLatencyStats();
+        }
+        else if (input.compare(0, 6, "cancel") == 0) {
+            // cancel [B|S|*] [symbol]: all resting orders, or one side and/or one symbol only
+            string side = "*";
+            int symbol = -1;
+            stringstream ss(input.substr(6));
+            ss >> side >> symbol;
+            client_.cancelAll(symbol, side == "*" ? 0 : side[0]);
+        }
+        else if (input.compare(0, 5, "quote") == 0) {
+            // quote [<symbol> <bid> <bid quantity> <ask> <ask quantity>]...: replaces all our quotes with these,
+            // a quantity of 0 leaves that side out, no entries at all just pulls the quotes
+            std::vector<Order> entries;
+            Order entry{};
+            stringstream ss(input.substr(5));
+            while (ss >> entry.symbol >> entry.price >> entry.quantity >> entry.stopPrice >> entry.displayQuantity)
+                entries.push_back(entry);
+            client_.massQuote(entries.data(), entries.size());
+        }
+        else if (!input.empty()) {
+            // Process the user input and send the order
+            // <B|S> <price, or M for a market order> <quantity> [symbol, default 0]
+            // followed by any of: I (IOC) | F (FOK) | D (day) | G<seconds> (good for that long), iceberg peak, @stop price,
+            // /A /N /O /B /D self-trade prevention (allow, cancel newest, oldest, both, decrement)
+            Order order{};
+            string price, option;
+            stringstream ss(input);
+            ss >> order.type >> price >> order.quantity >> order.symbol;
+            if (price == "M") order.execution = 'M';
+            else order.price = std::atof(price.c_str());
+            while (ss >> option) {
+                if (option == "I" || option == "F" || option == "D") order.execution = option[0];
+                else if (option[0] == 'G') {
+                    order.execution = 'G';
+                    order.expireTime = time(nullptr) + std::atoi(option.c_str() + 1);
                 }
-                break;
-            default:
-                break;
+                else if (option[0] == '@') order.stopPrice = std::atof(option.c_str() + 1);
+                else if (option[0] == '/' && option.size() == 2) order.selfTrade = option[1];
+                else order.displayQuantity = std::atoi(option.c_str());
+            }
+            client_.send(order);
         }
     }
-
-    double weightedAveragePrice(Order &order1, Order &order2)
-    {
-        double cost1 = order1.price * static_cast<double>(order1.quantity);
-        double cost2 = order2.price * static_cast<double>(order2.quantity);
-        double total_quantity = static_cast<double>(order1.quantity) + static_cast<double>(order2.quantity);
-
-        return (cost1 + cost2) / total_quantity;
-    }
-
-    int generateOrderId()
-    {
-        static int orderIdCounter = 0;
-        return ++orderIdCounter;
-    }
 };
 
-int main()
+int main(int argc, char* argv[])
 {
+    // Optional: --shm talk to a server on this host through shared memory (server started with --shm)
+    //           --login <n> log in as n (TCP only): a dropped connection is re-established and the reports
+    //                       missed in between are replayed
+    bool shm = false;
+    int login = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--shm") shm = true;
+        else if (arg == "--login" && i + 1 < argc) login = std::atoi(argv[++i]);
+    }
+
     boost::asio::io_service ioService;
 
     // Create and run the client
-    Client client(ioService, "localhost", 8080);
+    Client client(ioService, "localhost", 8080, shm, login);
     client.run();
 
     return 0;
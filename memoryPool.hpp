@@ -0,0 +1,426 @@
+#ifndef MEMORY_POOL_HPP
+#define MEMORY_POOL_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Array of T addressed by 32 bit index, stored in fixed size slabs.
+// Slabs are cache line aligned and never moved or freed, so references stay valid while the array grows.
+template<typename T>
+class SlabArray {
+public:
+    static const uint32_t kSlabBits = 12;
+    static const uint32_t kSlabSize = 1u << kSlabBits;  // Objects per slab
+
+    // Make sure at least capacity objects exist without further allocation
+    void reserve(size_t capacity)
+    {
+        while (capacity_() < capacity) slabs_.emplace_back(new Slab());
+    }
+
+    T& operator[](uint32_t index) { return slabs_[index >> kSlabBits]->items[index & (kSlabSize - 1)]; }
+    const T& operator[](uint32_t index) const { return slabs_[index >> kSlabBits]->items[index & (kSlabSize - 1)]; }
+
+    size_t capacity() const { return capacity_(); }
+
+private:
+    struct alignas(64) Slab {
+        T items[kSlabSize] = {};
+    };
+
+    std::vector<std::unique_ptr<Slab>> slabs_;
+
+    size_t capacity_() const { return slabs_.size() * kSlabSize; }
+};
+
+// Slab pool of T addressed by 32 bit index.
+// Freed slots go on a LIFO free list and are handed out again first; a new slab is only
+// allocated when the free list is empty, so after warm-up allocate()/release() never touch the heap.
+template<typename T>
+class SlabPool {
+public:
+    static const uint32_t npos = UINT32_MAX;
+
+    explicit SlabPool(size_t preallocate = 0)
+    {
+        reserve(preallocate);
+    }
+
+    // Make sure at least capacity objects exist without further allocation
+    void reserve(size_t capacity)
+    {
+        while (items_.capacity() < capacity) addSlab();
+    }
+
+    uint32_t allocate()
+    {
+        if (freeList_.empty()) addSlab();
+        uint32_t index = freeList_.back();
+        freeList_.pop_back();
+        return index;
+    }
+
+    void release(uint32_t index)
+    {
+        freeList_.push_back(index);
+    }
+
+    T& operator[](uint32_t index) { return items_[index]; }
+    const T& operator[](uint32_t index) const { return items_[index]; }
+
+    size_t capacity() const { return items_.capacity(); }
+    size_t inUse() const { return capacity() - freeList_.size(); }
+
+private:
+    SlabArray<T> items_;
+    std::vector<uint32_t> freeList_;
+
+    void addSlab()
+    {
+        uint32_t first = static_cast<uint32_t>(items_.capacity());
+        items_.reserve(first + SlabArray<T>::kSlabSize);
+        freeList_.reserve(items_.capacity());
+        // Push in reverse so the lowest index is handed out first
+        for (uint32_t i = SlabArray<T>::kSlabSize; i > 0; i--) freeList_.push_back(first + i - 1);
+    }
+};
+
+// FIFO queue on a power of two ring. It only grows (doubling) when full and never shrinks,
+// so a queue that has seen its peak depth once never allocates again.
+template<typename T>
+class RingQueue {
+public:
+    explicit RingQueue(size_t capacity = 8)
+        : items_(roundUp(capacity)), head_(0), size_(0)
+    {
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    T& front() { return items_[head_]; }
+
+    void push_back(const T& item)
+    {
+        if (size_ == items_.size()) grow();
+        items_[(head_ + size_) & (items_.size() - 1)] = item;
+        size_++;
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args)
+    {
+        push_back(T{std::forward<Args>(args)...});
+    }
+
+    void pop_front()
+    {
+        head_ = (head_ + 1) & (items_.size() - 1);
+        size_--;
+    }
+
+    void clear()
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+private:
+    std::vector<T> items_;
+    size_t head_;
+    size_t size_;
+
+    static size_t roundUp(size_t n)
+    {
+        size_t capacity = 1;
+        while (capacity < n) capacity <<= 1;
+        return capacity;
+    }
+
+    void grow()
+    {
+        std::vector<T> bigger(items_.size() * 2);
+        for (size_t i = 0; i < size_; i++) bigger[i] = items_[(head_ + i) & (items_.size() - 1)];
+        items_.swap(bigger);
+        head_ = 0;
+    }
+};
+
+// FIFO of T in fixed size chunks borrowed from a SlabPool shared by many queues.
+// An empty queue holds no memory, so thousands of mostly idle queues only cost what is actually
+// queued; after warm-up the shared pool hands chunks back and forth without touching the heap.
+// Items never move while queued, so &front() can be handed to an asynchronous write.
+template<typename T, uint32_t ChunkItems = 8>
+class ChunkedQueue {
+public:
+    struct Chunk {
+        T items[ChunkItems];
+        uint32_t next;
+    };
+    using Pool = SlabPool<Chunk>;
+    static const uint32_t npos = Pool::npos;
+    static const uint32_t kChunkItems = ChunkItems;
+
+    explicit ChunkedQueue(Pool& pool) : pool_(pool) {}
+    ~ChunkedQueue() { clear(); }
+
+    ChunkedQueue(const ChunkedQueue&) = delete;
+    ChunkedQueue& operator=(const ChunkedQueue&) = delete;
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    T& front() { return pool_[head_].items[headPos_]; }
+
+    void push_back(const T& item)
+    {
+        if (tail_ == npos || tailPos_ == ChunkItems) {
+            uint32_t chunk = pool_.allocate();
+            pool_[chunk].next = npos;
+            if (tail_ == npos) head_ = chunk;
+            else pool_[tail_].next = chunk;
+            tail_ = chunk;
+            tailPos_ = 0;
+        }
+        pool_[tail_].items[tailPos_++] = item;
+        size_++;
+    }
+
+    void pop_front()
+    {
+        headPos_++;
+        size_--;
+        if (size_ == 0) {
+            clear();
+        } else if (headPos_ == ChunkItems) {
+            uint32_t next = pool_[head_].next;
+            pool_.release(head_);
+            head_ = next;
+            headPos_ = 0;
+        }
+    }
+
+    void pop_front(size_t count)
+    {
+        while (count--) pop_front();
+    }
+
+    // Calls visit(T* items, size_t count) for the contiguous runs of items from the front (one per
+    // chunk), at most maxRuns of them, e.g. to build a gather write. Returns the items visited.
+    template<typename Visitor>
+    size_t visitRuns(size_t maxRuns, Visitor&& visit)
+    {
+        size_t visited = 0;
+        uint32_t chunk = head_;
+        uint32_t position = headPos_;
+        for (size_t run = 0; run < maxRuns && visited < size_; run++) {
+            size_t count = std::min<size_t>(ChunkItems - position, size_ - visited);
+            visit(&pool_[chunk].items[position], count);
+            visited += count;
+            chunk = pool_[chunk].next;
+            position = 0;
+        }
+        return visited;
+    }
+
+    void clear()
+    {
+        while (head_ != npos) {
+            uint32_t next = pool_[head_].next;
+            pool_.release(head_);
+            head_ = next;
+        }
+        tail_ = npos;
+        headPos_ = 0;
+        tailPos_ = 0;
+        size_ = 0;
+    }
+
+private:
+    Pool& pool_;
+    uint32_t head_ = npos;
+    uint32_t tail_ = npos;
+    uint32_t headPos_ = 0;  // Next item to pop in the head chunk
+    uint32_t tailPos_ = 0;  // Next free item in the tail chunk
+    size_t size_ = 0;
+};
+
+// Raw memory blocks of one size on cache line aligned slabs, with a free list.
+// For objects created through an allocator (allocate_shared), whose exact size (object plus control
+// block) is only known at the first allocation: that size becomes the block size. Larger requests
+// go to the heap.
+class BlockPool {
+public:
+    explicit BlockPool(size_t blocksPerSlab = 1024) : blocksPerSlab_(blocksPerSlab) {}
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    ~BlockPool()
+    {
+        for (void* slab : slabs_) ::operator delete(slab, std::align_val_t(kAlignment));
+    }
+
+    void* allocate(size_t size)
+    {
+        if (blockSize_ == 0) blockSize_ = (size + kAlignment - 1) / kAlignment * kAlignment;
+        if (size > blockSize_) return ::operator new(size);
+        if (!free_) addSlab();
+        FreeBlock* block = free_;
+        free_ = block->next;
+        return block;
+    }
+
+    void deallocate(void* pointer, size_t size)
+    {
+        if (size > blockSize_) {
+            ::operator delete(pointer);
+            return;
+        }
+        FreeBlock* block = static_cast<FreeBlock*>(pointer);
+        block->next = free_;
+        free_ = block;
+    }
+
+    // Make sure count blocks of size bytes exist without further allocation
+    void reserve(size_t count, size_t size)
+    {
+        if (blockSize_ == 0) blockSize_ = (size + kAlignment - 1) / kAlignment * kAlignment;
+        while (capacity_ < count) addSlab();
+    }
+
+private:
+    static const size_t kAlignment = 64;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    size_t blocksPerSlab_;
+    size_t blockSize_ = 0;
+    size_t capacity_ = 0;
+    FreeBlock* free_ = nullptr;
+    std::vector<void*> slabs_;
+
+    void addSlab()
+    {
+        char* slab = static_cast<char*>(::operator new(blockSize_ * blocksPerSlab_, std::align_val_t(kAlignment)));
+        slabs_.push_back(slab);
+        for (size_t i = blocksPerSlab_; i > 0; i--) deallocate(slab + (i - 1) * blockSize_, blockSize_);
+        capacity_ += blocksPerSlab_;
+    }
+};
+
+// Allocator handing out BlockPool blocks, e.g. std::allocate_shared<T>(PoolAllocator<T>(pool), ...)
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(BlockPool& pool) : pool_(pool) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : pool_(other.pool_) {}
+
+    bool operator==(const PoolAllocator& other) const noexcept { return &pool_ == &other.pool_; }
+    bool operator!=(const PoolAllocator& other) const noexcept { return &pool_ != &other.pool_; }
+
+    T* allocate(size_t n) const { return static_cast<T*>(pool_.allocate(sizeof(T) * n)); }
+    void deallocate(T* pointer, size_t n) const { pool_.deallocate(pointer, sizeof(T) * n); }
+
+private:
+    template<typename> friend class PoolAllocator;
+    BlockPool& pool_;
+};
+
+// Memory for one outstanding asio operation at a time (one per read loop, one per write loop...).
+// Asio allocates its operation object through the handler's associated allocator, so wrapping a
+// handler with makeCustomAllocHandler() recycles this block instead of calling operator new.
+// Falls back to the heap if the block is busy or too small.
+class HandlerMemory {
+public:
+    HandlerMemory() : inUse_(false) {}
+
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* allocate(size_t size)
+    {
+        if (!inUse_ && size < sizeof(storage_)) {
+            inUse_ = true;
+            return &storage_;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer)
+    {
+        if (pointer == &storage_)
+            inUse_ = false;
+        else
+            ::operator delete(pointer);
+    }
+
+private:
+    typename std::aligned_storage<256>::type storage_;
+    bool inUse_;
+};
+
+// Minimal allocator handing out HandlerMemory, used as the handler's associated allocator
+template<typename T>
+class HandlerAllocator {
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) : memory_(memory) {}
+
+    template<typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+    bool operator==(const HandlerAllocator& other) const noexcept { return &memory_ == &other.memory_; }
+    bool operator!=(const HandlerAllocator& other) const noexcept { return &memory_ != &other.memory_; }
+
+    T* allocate(size_t n) const { return static_cast<T*>(memory_.allocate(sizeof(T) * n)); }
+    void deallocate(T* pointer, size_t /*n*/) const { return memory_.deallocate(pointer); }
+
+private:
+    template<typename> friend class HandlerAllocator;
+    HandlerMemory& memory_;
+};
+
+template<typename Handler>
+class CustomAllocHandler {
+public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    CustomAllocHandler(HandlerMemory& memory, Handler handler)
+        : memory_(memory), handler_(std::move(handler))
+    {
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator_type(memory_); }
+
+    template<typename... Args>
+    void operator()(Args&&... args)
+    {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory& memory_;
+    Handler handler_;
+};
+
+template<typename Handler>
+inline CustomAllocHandler<Handler> makeCustomAllocHandler(HandlerMemory& memory, Handler handler)
+{
+    return CustomAllocHandler<Handler>(memory, std::move(handler));
+}
+
+#endif // MEMORY_POOL_HPP
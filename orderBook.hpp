@@ -0,0 +1,1008 @@
+#ifndef ORDER_BOOK_HPP
+#define ORDER_BOOK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "protocol.hpp"
+#include "memoryPool.hpp"
+#include "priceIndex.hpp"
+#include "timerWheel.hpp"
+
+// Hot part of a resting order: everything the matching walk reads or writes.
+// 16 bytes, so a cache line holds 4 orders and walking a price level touches as few lines as possible.
+struct alignas(16) HotOrder {
+    uint32_t next;      // Next (newer) order at the same price level, npos at the tail
+    uint32_t prev;      // Previous (older) order at the same price level, npos at the head
+    int32_t quantity;   // Remaining quantity
+    uint32_t owner;     // Client ID, what self-trade prevention compares in the matching walk
+};
+
+// Cold part of a resting order: identity and reporting data, only read when the order fills
+// or leaves the book
+struct ColdOrder {
+    int clientId;
+    int orderId;
+    std::time_t time;
+    int64_t clientSendTs;  // Echoed back in the fills of this order
+    char type;
+    char execution;        // 0, D(ay), G(ood till time) or Q(uote); stop orders: what they enter as once triggered
+    bool stop;             // Waiting in the book's trigger ladder, level is its stop price
+    char selfTrade;        // Stop orders: self-trade prevention once triggered
+    int symbol;            // Book and level the order rests on, to find it from its client's list
+    int level;
+    uint32_t clientNext;   // Next (older) resting order of the same client, in any book
+    uint32_t clientPrev;   // Previous (newer) resting order of the same client
+    int peak;              // Iceberg: displayed quantity each time it is replenished
+    int reserve;           // Iceberg: hidden quantity not yet displayed, 0 for plain orders
+    double price;          // Stop orders: limit price once triggered
+    std::time_t expireTime;             // Good till time orders
+    TimerWheel::TimerId expiryTimer;    // Good till time orders, npos for all others
+    uint32_t dayNext;      // Day orders: next (older) day order of the same book
+    uint32_t dayPrev;
+};
+
+// FIFO queue of orders at one price
+struct PriceLevel {
+    uint32_t head;   // Oldest order, matched first
+    uint32_t tail;   // Newest order
+    uint32_t count;  // Orders at this level
+    uint32_t top;    // Top order priority books: order that opened the level as a new best price, until it
+                     // first trades or leaves; npos otherwise
+    int64_t volume;  // Remaining displayed quantity at this level
+    int64_t hidden;  // Iceberg reserves at this level
+};
+
+// Receives every report produced by the book (fills of resting orders and of the incoming order)
+class ExecutionSink {
+public:
+    virtual void onReport(const Order& report) = 0;
+
+    // Report about a resting order (its fills, cancels and self-trade decrements) rather than the incoming
+    // one, limitPrice being the order's own price (an auction uncross fills it at another); the same as any
+    // other report unless the sink has to tell them apart
+    virtual void onRestingReport(const Order& report, double /*limitPrice*/) { onReport(report); }
+
+protected:
+    ~ExecutionSink() {}
+};
+
+// Resting orders of all books, split into parallel hot/cold slab arrays sharing one index. Stop orders
+// waiting for their trigger are kept here as well, so they are on their client's list like the others.
+// Orders that expire are tracked here too: good till time orders on a timer wheel ticking in wall clock
+// seconds, day orders on a list per book, so both are dropped in O(1) when their order leaves early.
+// The hot array also carries the intrusive next/prev links of the per-level FIFO lists, the cold
+// array those of the per-client lists, so all orders of one client can be found without a book scan.
+class OrderStore {
+public:
+    static const uint32_t npos = SlabPool<HotOrder>::npos;
+
+    // Preallocate room for capacity resting orders
+    void reserve(size_t capacity)
+    {
+        hot_.reserve(capacity);
+        cold_.reserve(hot_.capacity());
+        expiries_.reserve(capacity);
+    }
+
+    // Every book keeping its orders here, before its first order
+    void addBook(int symbol)
+    {
+        if (dayOrders_.size() <= static_cast<size_t>(symbol)) dayOrders_.resize(symbol + 1, uint32_t(npos));
+    }
+
+    // New resting order of clientId, at the front of the client's list
+    uint32_t allocate(int clientId)
+    {
+        uint32_t index = hot_.allocate();
+        if (cold_.capacity() < hot_.capacity()) cold_.reserve(hot_.capacity());
+        if (clients_.capacity() <= static_cast<size_t>(clientId)) clients_.reserve(clientId + 1);
+
+        ColdOrder& cold = cold_[index];
+        ClientOrders& client = clients_[clientId];
+        cold.clientId = clientId;
+        cold.expiryTimer = TimerWheel::npos;
+        cold.clientPrev = npos;
+        cold.clientNext = client.head;
+        if (client.head != npos) cold_[client.head].clientPrev = index;
+        client.head = index;
+        client.count++;
+        return index;
+    }
+
+    // Also takes the order off its client's list
+    void release(uint32_t index)
+    {
+        ColdOrder& cold = cold_[index];
+        ClientOrders& client = clients_[cold.clientId];
+        if (cold.clientPrev != npos) cold_[cold.clientPrev].clientNext = cold.clientNext;
+        else client.head = cold.clientNext;
+        if (cold.clientNext != npos) cold_[cold.clientNext].clientPrev = cold.clientPrev;
+        client.count--;
+        if (cold.expiryTimer != TimerWheel::npos) expiries_.cancel(cold.expiryTimer);
+        if (cold.execution == 'D') {
+            if (cold.dayPrev != npos) cold_[cold.dayPrev].dayNext = cold.dayNext;
+            else dayOrders_[cold.symbol] = cold.dayNext;
+            if (cold.dayNext != npos) cold_[cold.dayNext].dayPrev = cold.dayPrev;
+        }
+        hot_.release(index);
+    }
+
+    // Once the order's execution, symbol (and for G, expireTime) are set: a good till time order starts
+    // its timer, a day order goes on its book's day order list
+    void trackExpiry(uint32_t index)
+    {
+        ColdOrder& cold = cold_[index];
+        if (cold.execution == 'G') {
+            cold.expiryTimer = expiries_.schedule(static_cast<uint64_t>(cold.expireTime), index);
+        } else if (cold.execution == 'D') {
+            uint32_t& head = dayOrders_[cold.symbol];
+            cold.dayPrev = npos;
+            cold.dayNext = head;
+            if (head != npos) cold_[head].dayPrev = index;
+            head = index;
+        }
+    }
+
+    // Calls expire(uint32_t index) for every good till time order whose time has come by now (wall clock
+    // seconds); the order is still in its book and must be taken out (its timer is gone already)
+    template<typename Handler>
+    void expire(std::time_t now, Handler&& expire)
+    {
+        expiries_.advance(static_cast<uint64_t>(now), [&](uint64_t index) {
+            cold_[static_cast<uint32_t>(index)].expiryTimer = TimerWheel::npos;
+            expire(static_cast<uint32_t>(index));
+        });
+    }
+
+    // Newest day order of the book, follow cold().dayNext for the others
+    uint32_t dayOrders(int symbol) const
+    {
+        return dayOrders_[symbol];
+    }
+
+    HotOrder& hot(uint32_t index) { return hot_[index]; }
+    ColdOrder& cold(uint32_t index) { return cold_[index]; }
+
+    // Newest resting order of the client, follow cold().clientNext for the others
+    uint32_t clientOrders(int clientId) const
+    {
+        if (clientId < 0 || static_cast<size_t>(clientId) >= clients_.capacity()) return npos;
+        return clients_[clientId].head;
+    }
+
+    // Number of resting orders of the client, in all books
+    uint32_t clientOrderCount(int clientId) const
+    {
+        if (clientId < 0 || static_cast<size_t>(clientId) >= clients_.capacity()) return 0;
+        return clients_[clientId].count;
+    }
+
+private:
+    struct ClientOrders {
+        uint32_t head = npos;
+        uint32_t count = 0;
+    };
+
+    SlabPool<HotOrder> hot_;
+    SlabArray<ColdOrder> cold_;
+    SlabArray<ClientOrders> clients_;  // By client ID, which are handed out densely
+    TimerWheel expiries_{static_cast<uint64_t>(std::time(nullptr))};
+    std::vector<uint32_t> dayOrders_;  // Head of each book's day order list, by symbol
+};
+
+// Book interface, so every instrument can pick its own price index
+class Book {
+public:
+    virtual ~Book() {}
+
+    // Price inside the book's range and on a tick
+    virtual bool validPrice(double price) const = 0;
+
+    // Worst price a market order on side may trade at: bound (HUGE_VAL / 0 for none) moved onto a tick
+    // inside it, but no further than the end of the book's range
+    virtual double marketPrice(char side, double bound) const = 0;
+
+    // Match the incoming order against the opposite side and rest what is left, or cancel it ('C') for
+    // immediate or cancel, fill or kill and market orders. With order.selfTrade set, meeting a resting order
+    // of the same client is resolved as it says instead. A fill or kill order that cannot fill completely,
+    // self-trade prevention included, is cancelled before it touches the book. Fills of resting orders go to
+    // the sink as they happen; the incoming order gets one fill per price level it traded at, after those of
+    // the level's resting orders.
+    // order.quantity is left holding the resting quantity. Returns the quantity filled.
+    virtual int addOrder(Order& order, ExecutionSink& sink) = 0;
+
+    // Take a resting order of this book (found on its client's list) out, reporting it as cancelled ('C')
+    // with its side and the quantity it still had. A stop order's report carries its stop price.
+    virtual void cancel(uint32_t index, ExecutionSink& sink) = 0;
+
+    // Park a stop order (stopPrice set, on a tick of the book) until the book trades at or through its
+    // stop price
+    virtual void addStop(const Order& order) = 0;
+
+    // Next stop order the book's trades have triggered, as the order it enters as; false if none.
+    // Stops come out by stop price (buys from the lowest, then sells from the highest), each level in
+    // arrival order. Every level traded at since the previous call counts, and stops triggered by the trades
+    // of triggered stops queue up behind them.
+    virtual bool nextTriggered(Order& order) = 0;
+
+    // Price of the latest trade in this book, 0 before the first one
+    virtual double lastTradePrice() const = 0;
+
+    // Call phase of an auction: until uncross(), addOrder() rests limit orders without matching, so the book
+    // may cross. Immediate or cancel, fill or kill and market orders are cancelled whole.
+    virtual void startAuction() = 0;
+    virtual bool inAuction() const = 0;
+
+    // End the call phase: every crossing order trades at one equilibrium price, the one executing the most
+    // volume, then leaving the smallest imbalance, then closest to reference (0 = none, the middle of the
+    // crossed range). Resting orders fill in price-time priority, each reported like a resting fill; there is
+    // no self-trade prevention in the uncross.
+    // Returns the volume traded.
+    virtual int uncross(double reference, int64_t serverRecvTs, ExecutionSink& sink) = 0;
+
+    // Top levels of both sides, asks first
+    virtual void print(int depth) const = 0;
+};
+
+// How an incoming order is shared among the resting orders of a price level it cannot clear, chosen per
+// book at compile time. FIFO fills them in time priority. Pro-rata splits it in proportion to their
+// displayed quantities; with top order priority, the order that opened the level as a new best price is
+// filled first. Levels the incoming order clears fill completely either way.
+struct FifoAllocation {
+    static const bool kProRata = false;
+    static const bool kTopOrder = false;
+};
+
+struct ProRataAllocation {
+    static const bool kProRata = true;
+    static const bool kTopOrder = false;
+};
+
+struct TopOrderProRataAllocation {
+    static const bool kProRata = true;
+    static const bool kTopOrder = true;
+};
+
+// Limit order book over a ladder of price levels (one per tick), price-time priority unless Allocation
+// says otherwise. PriceIndex (DenseLadder or BitmapLadder) finds the next non-empty level when the best
+// one empties. FIFO books compile to the plain time priority walk, none of the pro-rata code is in it.
+template<typename PriceIndex, typename Allocation = FifoAllocation>
+class OrderBook : public Book {
+public:
+    static const uint32_t npos = OrderStore::npos;
+
+    OrderBook(int symbol, double lowerLimit, double upperLimit, double tickSize, OrderStore& store)
+        : symbol_(symbol), lowerLimit_(lowerLimit), tickSize_(tickSize),
+          levelCount_(static_cast<int>(std::llround((upperLimit - lowerLimit) / tickSize)) + 1),
+          bids_(levelCount_), asks_(levelCount_), buyStops_(levelCount_), sellStops_(levelCount_), store_(store)
+    {
+        store_.addBook(symbol_);
+        if (Allocation::kProRata) {
+            proRataOrders_.reserve(kProRataReserve);
+            proRataQuantities_.reserve(kProRataReserve);
+            proRataAllocations_.reserve(kProRataReserve);
+        }
+    }
+
+    bool validPrice(double price) const override
+    {
+        double ticks = (price - lowerLimit_) / tickSize_;
+        long level = std::lround(ticks);
+        return level >= 0 && level < levelCount_ && std::fabs(ticks - level) < 1e-6;
+    }
+
+    double marketPrice(char side, double bound) const override
+    {
+        if (side == 'B') {
+            double ticks = std::floor((bound - lowerLimit_) / tickSize_ + 1e-6);
+            return levelToPrice(static_cast<int>(std::max(0.0, std::min<double>(ticks, levelCount_ - 1))));
+        }
+        double ticks = std::ceil((bound - lowerLimit_) / tickSize_ - 1e-6);
+        return levelToPrice(static_cast<int>(std::max(0.0, std::min<double>(ticks, levelCount_ - 1))));
+    }
+
+    int addOrder(Order& order, ExecutionSink& sink) override
+    {
+        int limitLevel = priceToLevel(order.price);
+        bool isBuy = order.type == 'B';
+        if (auction_) {
+            if (immediateExecution(order.execution)) cancelRemainder(order, sink);
+            else rest(order, limitLevel);
+            return 0;
+        }
+        if (order.execution == 'F' && !(isBuy ? canFill<true>(order, limitLevel) : canFill<false>(order, limitLevel))) {
+            cancelRemainder(order, sink);
+            return 0;
+        }
+
+        MatchResult result = isBuy ? match<true>(order, limitLevel, sink) : match<false>(order, limitLevel, sink);
+
+        if (order.quantity > 0) {
+            if (result.selfTrade) cancelRemainder(order, sink, SelfTradePrevented);
+            else if (immediateExecution(order.execution)) cancelRemainder(order, sink);
+            else rest(order, limitLevel);
+        }
+        return result.filled;
+    }
+
+    void cancel(uint32_t index, ExecutionSink& sink) override
+    {
+        const ColdOrder& cold = store_.cold(index);
+        bool isBid = cold.type == 'B';
+        // Bids and sell stops both look for the next level downwards when their best one empties
+        bool downwards = cold.stop ? !isBid : isBid;
+        BookSide& own = cold.stop ? (isBid ? buyStops_ : sellStops_) : (isBid ? bids_ : asks_);
+        int levelIndex = cold.level;
+        PriceLevel& level = own.levels[levelIndex];
+
+        removeResting(level, index, 0, sink);
+        if (level.head == npos) {
+            own.index.remove(levelIndex);
+            if (own.best == levelIndex) own.best = downwards ? own.index.prev(levelIndex) : own.index.next(levelIndex);
+        }
+    }
+
+    void addStop(const Order& order) override
+    {
+        bool isBuy = order.type == 'B';
+        BookSide& own = isBuy ? buyStops_ : sellStops_;
+        int levelIndex = priceToLevel(order.stopPrice);
+        PriceLevel& level = own.levels[levelIndex];
+
+        uint32_t index = store_.allocate(order.clientId);
+        HotOrder& hot = store_.hot(index);
+        hot.quantity = order.quantity;
+        hot.owner = static_cast<uint32_t>(order.clientId);
+
+        ColdOrder& cold = store_.cold(index);
+        cold.orderId = order.orderId;
+        cold.time = order.time;
+        cold.clientSendTs = order.clientSendTs;
+        cold.type = order.type;
+        cold.execution = order.execution;
+        cold.stop = true;
+        cold.selfTrade = order.selfTrade;
+        cold.symbol = symbol_;
+        cold.level = levelIndex;
+        cold.peak = order.displayQuantity;
+        cold.reserve = 0;
+        cold.price = order.price;
+        cold.expireTime = order.expireTime;
+        store_.trackExpiry(index);
+
+        if (level.count == 0) own.index.add(levelIndex);
+        append(level, index);
+        level.volume += order.quantity;
+        if (own.best < 0 || (isBuy ? levelIndex < own.best : levelIndex > own.best)) own.best = levelIndex;
+        // A stop already through the last trade triggers on the next collection
+        if (lastTradeLevel_ >= 0) traded(lastTradeLevel_);
+    }
+
+    bool nextTriggered(Order& order) override
+    {
+        collectTriggered();
+        if (triggeredHead_ == npos) return false;
+
+        uint32_t index = triggeredHead_;
+        const HotOrder& hot = store_.hot(index);
+        const ColdOrder& cold = store_.cold(index);
+        triggeredHead_ = hot.next;
+        if (triggeredHead_ == npos) triggeredTail_ = npos;
+
+        order = Order{};
+        order.clientId = cold.clientId;
+        order.orderId = cold.orderId;
+        order.symbol = symbol_;
+        order.type = cold.type;
+        order.execution = cold.execution;
+        order.selfTrade = cold.selfTrade;
+        order.price = cold.price;
+        order.quantity = hot.quantity;
+        order.displayQuantity = cold.peak;
+        order.time = cold.time;
+        order.expireTime = cold.expireTime;
+        order.clientSendTs = cold.clientSendTs;
+        store_.release(index);
+        return true;
+    }
+
+    double lastTradePrice() const override
+    {
+        return lastTradeLevel_ >= 0 ? levelToPrice(lastTradeLevel_) : 0;
+    }
+
+    void startAuction() override
+    {
+        auction_ = true;
+    }
+
+    bool inAuction() const override
+    {
+        return auction_;
+    }
+
+    // Pairs the oldest bid of the best level with the oldest ask of the best level until one side has
+    // nothing left at the equilibrium price or better
+    int uncross(double reference, int64_t serverRecvTs, ExecutionSink& sink) override
+    {
+        auction_ = false;
+        int levelIndex = equilibriumLevel(reference);
+        if (levelIndex < 0) return 0;
+
+        double price = levelToPrice(levelIndex);
+        int volume = 0;
+        while (bids_.best >= levelIndex && asks_.best >= 0 && asks_.best <= levelIndex) {
+            PriceLevel& bidLevel = bids_.levels[bids_.best];
+            PriceLevel& askLevel = asks_.levels[asks_.best];
+            uint32_t bid = bidLevel.head;
+            uint32_t ask = askLevel.head;
+            int filled = std::min(store_.hot(bid).quantity, store_.hot(ask).quantity);
+            fillResting(bidLevel, bid, filled, price, serverRecvTs, sink);
+            fillResting(askLevel, ask, filled, price, serverRecvTs, sink);
+            volume += filled;
+
+            if (bidLevel.head == npos) {
+                bids_.index.remove(bids_.best);
+                bids_.best = bids_.index.prev(bids_.best);
+            }
+            if (askLevel.head == npos) {
+                asks_.index.remove(asks_.best);
+                asks_.best = asks_.index.next(asks_.best);
+            }
+        }
+        traded(levelIndex);
+        return volume;
+    }
+
+    void print(int depth) const override
+    {
+        printSide(asks_, false, "Top 5 Best Asks", depth);
+        printSide(bids_, true, "Top 5 Best Bids", depth);
+    }
+
+private:
+    struct BookSide {
+        explicit BookSide(int levelCount) : levels(levelCount, PriceLevel{npos, npos, 0, npos, 0, 0}), index(levelCount) {}
+
+        std::vector<PriceLevel> levels;
+        PriceIndex index;  // Which levels are non-empty
+        int best = -1;     // Index of the best non-empty level, -1 when the side is empty
+    };
+
+    int symbol_;
+    double lowerLimit_;
+    double tickSize_;
+    int levelCount_;
+    int lastTradeLevel_ = -1;
+    int tradedLow_ = -1;   // Range of levels traded at since the stops were last collected, -1 if none
+    int tradedHigh_ = -1;
+    bool auction_ = false;
+    BookSide bids_;
+    BookSide asks_;
+    BookSide buyStops_;   // Trigger ladder by stop price, best = lowest (the next to trigger as the price rises)
+    BookSide sellStops_;  // best = highest
+    uint32_t triggeredHead_ = npos;  // Triggered stops not yet handed out, linked through HotOrder::next
+    uint32_t triggeredTail_ = npos;
+    OrderStore& store_;
+    static const size_t kProRataReserve = 1024;  // Orders per level the pro-rata scratch arrays hold without growing
+    std::vector<uint32_t> proRataOrders_;        // Orders of the level being allocated, in time priority
+    std::vector<double> proRataQuantities_;      // Their displayed quantities
+    std::vector<int> proRataAllocations_;        // And what they get
+
+    int priceToLevel(double price) const
+    {
+        return static_cast<int>(std::lround((price - lowerLimit_) / tickSize_));
+    }
+
+    double levelToPrice(int level) const
+    {
+        return lowerLimit_ + level * tickSize_;
+    }
+
+    // Whether the opposite side holds quantity up to the limit (iceberg reserves included) the order can trade
+    // with, from the level volumes. With self-trade prevention, the client's own orders there are found on its
+    // order list: cancel oldest takes them out of the way, so they just do not count; every other mode ends
+    // the fills of the order at the first of them, so only what the walk fills ahead of it counts.
+    template<bool IsBuy>
+    bool canFill(const Order& order, int limitLevel) const
+    {
+        const BookSide& opposite = IsBuy ? asks_ : bids_;
+        int64_t quantity = order.quantity;
+        int ownLevel = -1;  // Best level up to the limit holding an order of the client
+        if (order.selfTrade) {
+            int64_t own = 0;
+            for (uint32_t index = store_.clientOrders(order.clientId); index != npos; index = store_.cold(index).clientNext) {
+                const ColdOrder& cold = store_.cold(index);
+                if (cold.symbol != symbol_ || cold.stop || cold.type == order.type ||
+                    (IsBuy ? cold.level > limitLevel : cold.level < limitLevel))
+                    continue;
+                own += store_.hot(index).quantity + cold.reserve;
+                if (ownLevel < 0 || (IsBuy ? cold.level < ownLevel : cold.level > ownLevel)) ownLevel = cold.level;
+            }
+            if (order.selfTrade == SelfTradeCancelOldest) {
+                quantity += own;
+                ownLevel = -1;
+            }
+        }
+
+        for (int level = opposite.best; level >= 0 && (IsBuy ? level <= limitLevel : level >= limitLevel);
+             level = IsBuy ? opposite.index.next(level) : opposite.index.prev(level)) {
+            if (level == ownLevel) {
+                // Time priority fills the displayed quantity of the orders ahead of it; pro-rata counts on none
+                if (!Allocation::kProRata) {
+                    uint32_t owner = static_cast<uint32_t>(order.clientId);
+                    for (uint32_t index = opposite.levels[level].head; store_.hot(index).owner != owner;
+                         index = store_.hot(index).next)
+                        quantity -= store_.hot(index).quantity;
+                }
+                return quantity <= 0;
+            }
+            quantity -= opposite.levels[level].volume + opposite.levels[level].hidden;
+            if (quantity <= 0) return true;
+        }
+        return false;
+    }
+
+    // Equilibrium level of the call phase, -1 if the book does not cross. Only the crossed range (lowest ask
+    // to highest bid) can hold it: the bids inside it are summed first, then one pass up the range merges the
+    // non-empty ask and bid levels, keeping the cumulative ask volume at or below and bid volume at or above.
+    // Both are constant between two of those levels, so each such stretch of ticks is judged once, at its
+    // tick closest to reference. Iceberg reserves count.
+    int equilibriumLevel(double reference) const
+    {
+        int low = asks_.best;
+        int high = bids_.best;
+        if (low < 0 || high < low) return -1;
+
+        int64_t demand = 0;
+        int bid = high;  // Lowest bid level of the range once summed
+        for (int level = high; level >= low; level = bids_.index.prev(level)) {
+            demand += bids_.levels[level].volume + bids_.levels[level].hidden;
+            bid = level;
+        }
+        int referenceLevel = reference > 0 ? priceToLevel(reference) : low + (high - low) / 2;
+
+        int64_t supply = 0;
+        int64_t bestVolume = 0;
+        int64_t bestImbalance = 0;
+        int bestDistance = 0;
+        int bestLevel = -1;
+        int ask = low;  // Next ask level to join the supply, -1 past the last
+        for (int level = low; level <= high;) {
+            if (ask == level) {
+                supply += asks_.levels[ask].volume + asks_.levels[ask].hidden;
+                ask = asks_.index.next(ask);
+            }
+            // Ticks up to the next ask level, or the next bid level (its volume leaves the demand above it)
+            int end = high;
+            if (ask >= 0 && ask - 1 < end) end = ask - 1;
+            if (bid >= 0 && bid < end) end = bid;
+
+            int candidate = std::max(level, std::min(end, referenceLevel));
+            int64_t volume = std::min(demand, supply);
+            int64_t imbalance = std::abs(demand - supply);
+            int distance = std::abs(candidate - referenceLevel);
+            if (volume > bestVolume || (volume == bestVolume && (imbalance < bestImbalance ||
+                                                                 (imbalance == bestImbalance && distance < bestDistance)))) {
+                bestVolume = volume;
+                bestImbalance = imbalance;
+                bestDistance = distance;
+                bestLevel = candidate;
+            }
+            if (bid == end) {
+                demand -= bids_.levels[bid].volume + bids_.levels[bid].hidden;
+                bid = bids_.index.next(bid);
+            }
+            level = end + 1;
+        }
+        return bestLevel;
+    }
+
+    void traded(int levelIndex)
+    {
+        lastTradeLevel_ = levelIndex;
+        if (tradedLow_ < 0 || levelIndex < tradedLow_) tradedLow_ = levelIndex;
+        if (levelIndex > tradedHigh_) tradedHigh_ = levelIndex;
+    }
+
+    // Move every stop level the trades since the last collection reached, whole, to the back of the triggered
+    // queue: buy stops up to the highest of them, sell stops down to the lowest, so a sweep across several
+    // levels triggers the stops in between. Only levels that triggered are visited.
+    void collectTriggered()
+    {
+        if (tradedHigh_ < 0) return;
+        while (buyStops_.best >= 0 && buyStops_.best <= tradedHigh_) {
+            int level = buyStops_.best;
+            buyStops_.best = buyStops_.index.next(level);
+            trigger(buyStops_, level);
+        }
+        while (sellStops_.best >= 0 && sellStops_.best >= tradedLow_) {
+            int level = sellStops_.best;
+            sellStops_.best = sellStops_.index.prev(level);
+            trigger(sellStops_, level);
+        }
+        tradedLow_ = tradedHigh_ = -1;
+    }
+
+    void trigger(BookSide& side, int levelIndex)
+    {
+        PriceLevel& level = side.levels[levelIndex];
+        if (triggeredTail_ != npos) store_.hot(triggeredTail_).next = level.head;
+        else triggeredHead_ = level.head;
+        triggeredTail_ = level.tail;
+        side.index.remove(levelIndex);
+        level = PriceLevel{npos, npos, 0, npos, 0, 0};
+    }
+
+    // Unfilled quantity of an order that must not rest, reported as cancelled
+    void cancelRemainder(Order& order, ExecutionSink& sink, char reason = 0)
+    {
+        Order report(order);
+        report.type = 'C';
+        report.side = order.type;
+        report.reason = reason;
+        sink.onReport(report);
+        order.quantity = 0;
+    }
+
+    // What a matching walk did with the incoming order, besides the fills it reported
+    struct MatchResult {
+        int filled = 0;
+        bool selfTrade = false;  // Self-trade prevention cancels what is left of it
+    };
+
+    // Walk the opposite side from its best level while it crosses the limit. Every resting order met is
+    // checked against the incoming order's owner, on the hot record the walk reads anyway; without
+    // self-trade prevention the owner is npos, which no order has. A level the incoming order clears is
+    // swept in bulk; what it took from each level is reported as one fill of the incoming order.
+    template<bool IsBuy>
+    MatchResult match(Order& order, int limitLevel, ExecutionSink& sink)
+    {
+        BookSide& opposite = IsBuy ? asks_ : bids_;
+        MatchResult result;
+        uint32_t owner = order.selfTrade ? static_cast<uint32_t>(order.clientId) : npos;
+
+        while (order.quantity > 0 && !result.selfTrade && opposite.best >= 0 &&
+               (IsBuy ? opposite.best <= limitLevel : opposite.best >= limitLevel)) {
+            PriceLevel& level = opposite.levels[opposite.best];
+            double price = levelToPrice(opposite.best);
+            int filledBefore = result.filled;
+
+            // Folded away in FIFO books
+            if (Allocation::kProRata && order.quantity < level.volume)
+                allocateProRata(order, level, opposite.best, owner, result, sink);
+            else if (order.quantity >= level.volume && level.hidden == 0)
+                sweepLevel(order, level, opposite.best, owner, result, sink);
+
+            while (order.quantity > 0 && !result.selfTrade && level.head != npos) {
+                uint32_t index = level.head;
+                if (store_.hot(index).owner == owner) {
+                    if ((result.selfTrade = preventSelfTrade(order, level, index, sink))) break;
+                    continue;
+                }
+                int filled = std::min<int>(order.quantity, store_.hot(index).quantity);
+                order.quantity -= filled;
+                result.filled += filled;
+                traded(opposite.best);
+                // Each resting owner gets its own fill, triggered by the incoming order
+                fillResting(level, index, filled, price, order.serverRecvTs, sink);
+            }
+
+            if (result.filled > filledBefore) {
+                Order fill(order);
+                fill.price = price;
+                fill.quantity = result.filled - filledBefore;
+                sink.onReport(fill);
+            }
+
+            if (level.head == npos) {
+                opposite.index.remove(opposite.best);
+                opposite.best = IsBuy ? opposite.index.next(opposite.best) : opposite.index.prev(opposite.best);
+            }
+        }
+
+        return result;
+    }
+
+    // Level the incoming order clears, with no iceberg reserve to replenish: every order fills whole, so none
+    // is unlinked on its own; the level's links and totals are fixed up once at the end. Stops at an order
+    // of the incoming order's own client, leaving it at the head for the FIFO walk to resolve.
+    void sweepLevel(Order& order, PriceLevel& level, int levelIndex, uint32_t owner, MatchResult& result, ExecutionSink& sink)
+    {
+        double price = levelToPrice(levelIndex);
+        uint32_t index = level.head;
+        int swept = 0;
+        uint32_t count = 0;
+        while (index != npos && store_.hot(index).owner != owner) {
+            const HotOrder& hot = store_.hot(index);
+            uint32_t next = hot.next;
+            swept += hot.quantity;
+            count++;
+            reportFill(index, hot.quantity, price, order.serverRecvTs, sink);
+            store_.release(index);
+            index = next;
+        }
+        if (count == 0) return;
+
+        order.quantity -= swept;
+        result.filled += swept;
+        traded(levelIndex);
+        level.volume -= swept;
+        level.count -= count;
+        level.head = index;
+        if (index != npos) store_.hot(index).prev = npos;
+        else level.tail = npos;
+        if (Allocation::kTopOrder) level.top = npos; // It was the oldest order, swept first
+    }
+
+    // Pro-rata allocation of the incoming order over a level holding more than it wants. Self trades are
+    // resolved first and the top order (if any) filled. Then every order gets floor(its quantity * incoming
+    // / level quantity), and the few lots the rounding leaves go one each to the oldest orders, so the
+    // outcome is deterministic. The per-order arithmetic runs over flat arrays the compiler can vectorize;
+    // products stay exact in doubles up to 2^53. Leaves order.quantity at 0 unless a self trade cancels it.
+    void allocateProRata(Order& order, PriceLevel& level, int levelIndex, uint32_t owner, MatchResult& result, ExecutionSink& sink)
+    {
+        if (Allocation::kTopOrder && level.top != npos && store_.hot(level.top).owner != owner) {
+            uint32_t top = level.top;
+            level.top = npos;
+            int filled = std::min(order.quantity, store_.hot(top).quantity);
+            fillIncoming(order, level, top, filled, levelIndex, result, sink);
+            if (order.quantity == 0) return;
+        }
+
+        proRataOrders_.clear();
+        proRataQuantities_.clear();
+        double total = 0;
+        for (uint32_t index = level.head; index != npos;) {
+            const HotOrder& hot = store_.hot(index);
+            uint32_t next = hot.next;
+            if (hot.owner == owner) {
+                if ((result.selfTrade = preventSelfTrade(order, level, index, sink))) return;
+            } else {
+                proRataOrders_.push_back(index);
+                proRataQuantities_.push_back(hot.quantity);
+                total += hot.quantity;
+            }
+            index = next;
+        }
+
+        size_t count = proRataOrders_.size();
+        proRataAllocations_.resize(count);
+        const double* resting = proRataQuantities_.data();
+        int* allocation = proRataAllocations_.data();
+        if (order.quantity < total) {
+            double incoming = order.quantity;
+            int left = order.quantity;
+            for (size_t i = 0; i < count; i++) allocation[i] = static_cast<int>(resting[i] * incoming / total);
+            for (size_t i = 0; i < count; i++) left -= allocation[i];
+            // Each order's share is below its quantity and at most count - 1 lots are left
+            for (size_t i = 0; left > 0; i++) {
+                allocation[i]++;
+                left--;
+            }
+        } else {
+            for (size_t i = 0; i < count; i++) allocation[i] = static_cast<int>(resting[i]);
+        }
+
+        for (size_t i = 0; i < count; i++)
+            if (allocation[i] > 0) fillIncoming(order, level, proRataOrders_[i], allocation[i], levelIndex, result, sink);
+    }
+
+    // Fill of the incoming order against a resting one, outside the FIFO walk
+    void fillIncoming(Order& order, PriceLevel& level, uint32_t index, int filled, int levelIndex, MatchResult& result,
+                      ExecutionSink& sink)
+    {
+        double price = levelToPrice(levelIndex);
+        order.quantity -= filled;
+        result.filled += filled;
+        traded(levelIndex);
+        fillResting(level, index, filled, price, order.serverRecvTs, sink);
+    }
+
+    // The incoming order met a resting order of level of its own client. Resolved as the
+    // incoming order's selfTrade says; true if what is left of the incoming order is to be cancelled.
+    bool preventSelfTrade(Order& order, PriceLevel& level, uint32_t index, ExecutionSink& sink)
+    {
+        switch (order.selfTrade) {
+        case SelfTradeCancelNewest:
+            return true;
+        case SelfTradeCancelOldest:
+            removeResting(level, index, SelfTradePrevented, sink);
+            return false;
+        case SelfTradeCancelBoth:
+            removeResting(level, index, SelfTradePrevented, sink);
+            return true;
+        default: {
+            // Decrement: iceberg reserves count, and are taken first so the displayed quantity keeps its place
+            HotOrder& hot = store_.hot(index);
+            ColdOrder& cold = store_.cold(index);
+            int resting = hot.quantity + cold.reserve;
+            if (resting > order.quantity) {
+                int fromReserve = std::min(order.quantity, cold.reserve);
+                cold.reserve -= fromReserve;
+                level.hidden -= fromReserve;
+                hot.quantity -= order.quantity - fromReserve;
+                level.volume -= order.quantity - fromReserve;
+                Order report = restingReport(index, 'D', SelfTradePrevented);
+                report.quantity = order.quantity;
+                sink.onRestingReport(report, report.price);
+                return true;
+            }
+            removeResting(level, index, SelfTradePrevented, sink);
+            if (resting == order.quantity) return true;
+            order.quantity -= resting;
+            Order report(order);
+            report.type = 'D';
+            report.side = order.type;
+            report.reason = SelfTradePrevented;
+            report.quantity = resting;
+            sink.onReport(report);
+            return false;
+        }
+        }
+    }
+
+    // Report about a resting order of this book, with what it has left
+    Order restingReport(uint32_t index, char type, char reason) const
+    {
+        const HotOrder& hot = store_.hot(index);
+        const ColdOrder& cold = store_.cold(index);
+        Order report{};
+        report.clientId = cold.clientId;
+        report.orderId = cold.orderId;
+        report.symbol = symbol_;
+        report.type = type;
+        report.side = cold.type;
+        report.reason = reason;
+        report.price = cold.stop ? cold.price : levelToPrice(cold.level);
+        report.stopPrice = cold.stop ? levelToPrice(cold.level) : 0;
+        report.quantity = hot.quantity + cold.reserve;
+        report.time = cold.time;
+        report.clientSendTs = cold.clientSendTs;
+        return report;
+    }
+
+    // Take a resting order off its level and out of the store, reported as cancelled. The caller moves the
+    // side's best level on if this emptied it.
+    void removeResting(PriceLevel& level, uint32_t index, char reason, ExecutionSink& sink)
+    {
+        Order report = restingReport(index, 'C', reason);
+        level.volume -= store_.hot(index).quantity;
+        level.hidden -= store_.cold(index).reserve;
+        unlink(level, index);
+        store_.release(index);
+        sink.onRestingReport(report, report.price);
+    }
+
+    // Fill of a resting order, reported to its owner; a filled order leaves its level, or shows its next peak
+    void fillResting(PriceLevel& level, uint32_t index, int filled, double price, int64_t serverRecvTs, ExecutionSink& sink)
+    {
+        HotOrder& resting = store_.hot(index);
+        resting.quantity -= filled;
+        level.volume -= filled;
+        reportFill(index, filled, price, serverRecvTs, sink);
+
+        if (resting.quantity == 0) {
+            if (store_.cold(index).reserve > 0) {
+                replenish(level, index);
+            } else {
+                unlink(level, index);
+                store_.release(index);
+            }
+        }
+    }
+
+    // Fill report to the owner of a resting order, triggered by an order that came in at serverRecvTs
+    void reportFill(uint32_t index, int filled, double price, int64_t serverRecvTs, ExecutionSink& sink) const
+    {
+        const ColdOrder& cold = store_.cold(index);
+        Order report{};
+        report.clientId = cold.clientId;
+        report.orderId = cold.orderId;
+        report.symbol = symbol_;
+        report.type = cold.type;
+        report.price = price;
+        report.quantity = filled;
+        report.time = cold.time;
+        report.clientSendTs = cold.clientSendTs;
+        report.serverRecvTs = serverRecvTs;
+        sink.onRestingReport(report, levelToPrice(cold.level));
+    }
+
+    void rest(const Order& order, int levelIndex)
+    {
+        bool isBid = order.type == 'B';
+        BookSide& own = isBid ? bids_ : asks_;
+        PriceLevel& level = own.levels[levelIndex];
+
+        uint32_t index = store_.allocate(order.clientId);
+        bool iceberg = order.displayQuantity > 0 && order.displayQuantity < order.quantity;
+
+        HotOrder& hot = store_.hot(index);
+        hot.quantity = iceberg ? order.displayQuantity : order.quantity;
+        hot.owner = static_cast<uint32_t>(order.clientId);
+
+        ColdOrder& cold = store_.cold(index);
+        cold.orderId = order.orderId;
+        cold.time = order.time;
+        cold.clientSendTs = order.clientSendTs;
+        cold.type = order.type;
+        cold.execution = order.execution;
+        cold.stop = false;
+        cold.symbol = symbol_;
+        cold.level = levelIndex;
+        cold.peak = hot.quantity;
+        cold.reserve = order.quantity - hot.quantity;
+        cold.expireTime = order.expireTime;
+        store_.trackExpiry(index);
+
+        if (level.count == 0) own.index.add(levelIndex);
+        if (Allocation::kTopOrder && level.count == 0)
+            level.top = own.best < 0 || (isBid ? levelIndex > own.best : levelIndex < own.best) ? index : npos;
+        append(level, index);
+        level.volume += hot.quantity;
+        level.hidden += cold.reserve;
+
+        if (own.best < 0 || (isBid ? levelIndex > own.best : levelIndex < own.best)) own.best = levelIndex;
+    }
+
+    // Iceberg whose displayed quantity was just used up: display the next peak from its reserve and
+    // queue it at the back of its level, losing its time priority like a new order would
+    void replenish(PriceLevel& level, uint32_t index)
+    {
+        HotOrder& hot = store_.hot(index);
+        ColdOrder& cold = store_.cold(index);
+        int peak = std::min(cold.peak, cold.reserve);
+        cold.reserve -= peak;
+        hot.quantity = peak;
+        level.volume += peak;
+        level.hidden -= peak;
+        if (level.tail != index) {
+            unlink(level, index);
+            append(level, index);
+        }
+    }
+
+    void append(PriceLevel& level, uint32_t index)
+    {
+        HotOrder& order = store_.hot(index);
+        order.next = npos;
+        order.prev = level.tail;
+        if (level.tail != npos) store_.hot(level.tail).next = index;
+        else level.head = index;
+        level.tail = index;
+        level.count++;
+    }
+
+    void unlink(PriceLevel& level, uint32_t index)
+    {
+        if (Allocation::kTopOrder && level.top == index) level.top = npos;
+        HotOrder& order = store_.hot(index);
+        if (order.prev != npos) store_.hot(order.prev).next = order.next;
+        else level.head = order.next;
+        if (order.next != npos) store_.hot(order.next).prev = order.prev;
+        else level.tail = order.prev;
+        level.count--;
+    }
+
+    void printSide(const BookSide& side, bool isBid, const std::string& title, int depth) const
+    {
+        std::cout << "--------------------------------\n";
+        std::cout << title << "-----------------\n";
+        std::cout << "Orders\tPrice\tVolume\n";
+
+        int level = side.best;
+        while (level >= 0 && depth--) {
+            std::cout << side.levels[level].count << "\t" << levelToPrice(level) << "\t" << side.levels[level].volume << "\n";
+            level = isBid ? side.index.prev(level) : side.index.next(level);
+        }
+    }
+};
+
+#endif // ORDER_BOOK_HPP
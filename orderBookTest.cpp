@@ -0,0 +1,369 @@
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "orderBook.hpp"
+#include "preTradeRisk.hpp"
+
+// Order book regression checks, run without a server: every case builds a fresh book and checks the reports
+// and the book state an order sequence leaves behind. Exits non-zero on the first failure.
+
+struct Reports : public ExecutionSink {
+    std::vector<Order> all;
+    void onReport(const Order& report) override { all.push_back(report); }
+};
+
+int failures = 0;
+
+void check(bool condition, const char* what)
+{
+    if (!condition) {
+        std::cout << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+Order makeOrder(int clientId, int orderId, char type, double price, int quantity, char execution = 0, char selfTrade = 0)
+{
+    Order order{};
+    order.clientId = clientId;
+    order.orderId = orderId;
+    order.type = type;
+    order.price = price;
+    order.quantity = quantity;
+    order.execution = execution;
+    order.selfTrade = selfTrade;
+    return order;
+}
+
+// A buy sweeping 5.00 and 5.10 trades through a sell stop at 5.05 and must trigger it; the stop's own trade
+// at 4.90 then triggers the sell stop at 4.95 below, in the same cascade
+void stopTriggeredBySweep()
+{
+    OrderStore store;
+    OrderBook<DenseLadder> book(0, 1.0, 10.0, 0.05, store);
+    Reports reports;
+
+    Order ask1 = makeOrder(1, 1, 'S', 5.00, 10);
+    Order ask2 = makeOrder(1, 2, 'S', 5.10, 10);
+    Order bid = makeOrder(1, 3, 'B', 4.90, 10);
+    book.addOrder(ask1, reports);
+    book.addOrder(ask2, reports);
+    book.addOrder(bid, reports);
+
+    Order stop = makeOrder(2, 4, 'S', 4.90, 5);
+    stop.stopPrice = 5.05;
+    book.addStop(stop);
+    Order lowerStop = makeOrder(2, 5, 'S', 4.90, 5);
+    lowerStop.stopPrice = 4.95;
+    book.addStop(lowerStop);
+
+    Order sweep = makeOrder(3, 6, 'B', 5.10, 20);
+    check(book.addOrder(sweep, reports) == 20, "sweep fills 20");
+
+    Order triggered;
+    check(book.nextTriggered(triggered) && triggered.orderId == 4, "stop at 5.05 triggered by the sweep");
+    check(book.addOrder(triggered, reports) == 5, "triggered stop trades at 4.90");
+    check(book.nextTriggered(triggered) && triggered.orderId == 5, "stop at 4.95 triggered by the stop's trade");
+    check(!book.nextTriggered(triggered), "no stop left");
+}
+
+// Fill or kill against a level where self-trade prevention stops it at the client's own order: killed whole
+// unless enough of the other clients' quantity is ahead of it, or cancel oldest takes it out of the way
+void fillOrKillWithSelfTrade()
+{
+    struct Case {
+        const char* what;
+        int ownFirst;    // Own quantity ahead of the other client's
+        int other;
+        int ownBehind;
+        char selfTrade;
+        int filled;
+    } cases[] = {
+        {"FOK killed at own order ahead", 10, 5, 0, SelfTradeCancelNewest, 0},
+        {"FOK killed with too little ahead of own order", 0, 10, 10, SelfTradeCancelNewest, 0},
+        {"FOK fills ahead of own order", 0, 15, 10, SelfTradeCancelNewest, 15},
+        {"FOK killed at own order with decrement", 10, 15, 0, SelfTradeDecrement, 0},
+        {"FOK fills past own order cancelled as oldest", 10, 15, 0, SelfTradeCancelOldest, 15},
+        {"FOK killed without own order counting as oldest", 10, 5, 0, SelfTradeCancelOldest, 0},
+    };
+    for (const Case& c : cases) {
+        OrderStore store;
+        OrderBook<DenseLadder> book(0, 1.0, 10.0, 0.05, store);
+        Reports reports;
+        Order own = makeOrder(1, 1, 'S', 4.00, c.ownFirst);
+        Order other = makeOrder(2, 2, 'S', 4.00, c.other);
+        Order ownBehind = makeOrder(1, 3, 'S', 4.00, c.ownBehind);
+        if (c.ownFirst) book.addOrder(own, reports);
+        book.addOrder(other, reports);
+        if (c.ownBehind) book.addOrder(ownBehind, reports);
+
+        Order fok = makeOrder(1, 4, 'B', 4.05, 15, 'F', c.selfTrade);
+        check(book.addOrder(fok, reports) == c.filled, c.what);
+        bool killed = reports.all.back().type == 'C' && reports.all.back().orderId == 4 && reports.all.back().reason == 0;
+        check(c.filled ? !killed : killed && reports.all.back().quantity == 15, c.what);
+    }
+}
+
+// Books fills and cancels into the risk counters like the server's risk sink
+struct RiskReports : public ExecutionSink {
+    PreTradeRisk& risk;
+    explicit RiskReports(PreTradeRisk& risk) : risk(risk) {}
+
+    void onReport(const Order& report) override
+    {
+        if (report.type == 'B' || report.type == 'S') risk.onFill(report, false);
+    }
+
+    void onRestingReport(const Order& report, double limitPrice) override
+    {
+        if (report.type == 'B' || report.type == 'S') risk.onFill(report, true, limitPrice);
+        else if (report.type == 'C' || report.type == 'D') risk.onCancel(report);
+    }
+};
+
+// A bid uncrossed below its limit must give back all the open buy notional it was booked with: 10@5.00
+// filled at 4.50 leaves 45 spent and nothing open, so a 955 buy fits a credit limit of 1000 exactly
+void uncrossReleasesOpenNotional()
+{
+    OrderStore store;
+    OrderBook<DenseLadder> book(0, 1.0, 10.0, 0.05, store);
+    PreTradeRisk risk(store);
+    risk.setInstruments(1);
+    risk.defaults().creditLimit = 1000;
+    RiskReports reports(risk);
+
+    book.startAuction();
+    Order bid = makeOrder(1, 1, 'B', 5.00, 10);
+    Order ask = makeOrder(2, 2, 'S', 4.00, 10);
+    book.addOrder(bid, reports);
+    risk.onRested(bid);
+    book.addOrder(ask, reports);
+    risk.onRested(ask);
+    check(book.uncross(4.50, 0, reports) == 10, "auction uncrosses 10");
+    check(std::fabs(book.lastTradePrice() - 4.50) < 1e-9, "auction uncrosses at the reference");
+
+    Order next = makeOrder(1, 3, 'B', 1.00, 955);
+    check(risk.check(next) == 0, "uncrossed bid leaves no open buy notional");
+    next.quantity = 956;
+    check(risk.check(next) == RejectCredit, "credit limit still applies after the uncross");
+}
+
+// Resting orders of an auction test book, all entered in the call phase
+struct AuctionOrder {
+    int orderId;
+    char type;
+    double price;
+    int quantity;
+    int displayQuantity;
+};
+
+// Uncross a book built from orders during its call phase; checks the volume and equilibrium price
+void checkUncross(const char* what, std::initializer_list<AuctionOrder> orders, double reference, int volume,
+                  double price, Reports& reports)
+{
+    OrderStore store;
+    OrderBook<DenseLadder> book(0, 1.0, 10.0, 0.05, store);
+    book.startAuction();
+    for (const AuctionOrder& entry : orders) {
+        Order order = makeOrder(entry.orderId, entry.orderId, entry.type, entry.price, entry.quantity);
+        order.displayQuantity = entry.displayQuantity;
+        check(book.addOrder(order, reports) == 0, what);
+    }
+    check(book.uncross(reference, 0, reports) == volume, what);
+    check(std::fabs(book.lastTradePrice() - price) < 1e-9, what);
+    check(!book.inAuction(), what);
+}
+
+// Equilibrium price rules: most volume, then smallest imbalance, then closest to the reference (the middle of
+// the crossed range without one); iceberg reserves count; fills in price-time priority at the one price
+void callAuction()
+{
+    Reports reports;
+    checkUncross("equilibrium executes the most volume",
+                 {{1, 'B', 5.00, 10, 0}, {2, 'B', 4.90, 10, 0}, {3, 'S', 4.80, 10, 0}, {4, 'S', 4.90, 10, 0}},
+                 5.00, 20, 4.90, reports);
+    checkUncross("equilibrium leaves the smallest imbalance, then is closest to the reference",
+                 {{1, 'B', 5.00, 10, 0}, {2, 'S', 4.80, 10, 0}, {3, 'S', 4.90, 5, 0}}, 5.00, 10, 4.85, reports);
+    checkUncross("equilibrium at the reference inside the crossed range",
+                 {{1, 'B', 5.00, 10, 0}, {2, 'S', 4.00, 10, 0}}, 4.50, 10, 4.50, reports);
+    checkUncross("equilibrium closest to a reference outside the crossed range",
+                 {{1, 'B', 5.00, 10, 0}, {2, 'S', 4.00, 10, 0}}, 3.00, 10, 4.00, reports);
+    checkUncross("equilibrium in the middle of the crossed range without a reference",
+                 {{1, 'B', 4.95, 10, 0}, {2, 'S', 4.00, 10, 0}}, 0, 10, 4.45, reports);
+    checkUncross("iceberg reserves count toward the equilibrium volume",
+                 {{1, 'B', 5.00, 20, 5}, {2, 'S', 4.80, 10, 0}, {3, 'S', 4.95, 10, 0}}, 0, 20, 4.95, reports);
+    checkUncross("no equilibrium in a book that does not cross",
+                 {{1, 'B', 4.00, 10, 0}, {2, 'S', 4.05, 10, 0}}, 0, 0, 0, reports);
+
+    reports.all.clear();
+    checkUncross("uncross in price-time priority",
+                 {{1, 'B', 4.90, 10, 0}, {2, 'B', 5.00, 10, 0}, {3, 'B', 4.90, 10, 0}, {4, 'S', 4.80, 15, 0}},
+                 4.90, 15, 4.90, reports);
+    std::vector<Order> bidFills;
+    for (const Order& report : reports.all)
+        if (report.type == 'B') bidFills.push_back(report);
+    check(bidFills.size() == 2 && bidFills[0].orderId == 2 && bidFills[0].quantity == 10 &&
+          bidFills[1].orderId == 1 && bidFills[1].quantity == 5, "best bid first, then the oldest at 4.90");
+    for (const Order& fill : bidFills) check(std::fabs(fill.price - 4.90) < 1e-9, "bids fill at the equilibrium price");
+
+    // Immediate or cancel, fill or kill and market orders are cancelled whole in the call phase, never rest
+    for (char execution : {'I', 'F', 'M'}) {
+        OrderStore store;
+        OrderBook<DenseLadder> book(0, 1.0, 10.0, 0.05, store);
+        Reports cancels;
+        book.startAuction();
+        Order ask = makeOrder(1, 1, 'S', 4.00, 10);
+        book.addOrder(ask, cancels);
+        Order order = makeOrder(2, 2, 'B', 5.00, 10, execution);
+        check(book.addOrder(order, cancels) == 0, "no immediate order fills in the call phase");
+        check(cancels.all.size() == 1 && cancels.all[0].type == 'C' && cancels.all[0].quantity == 10,
+              "immediate order cancelled whole in the call phase");
+        check(book.uncross(0, 0, cancels) == 0, "cancelled immediate order does not take part in the uncross");
+    }
+}
+
+// Quantity each resting order (by order ID) got in fills reported to the sink
+std::vector<int> restingFills(const Reports& reports, char side, int orders)
+{
+    std::vector<int> filled(orders + 1, 0);
+    for (const Order& report : reports.all)
+        if (report.type == side && report.orderId <= orders) filled[report.orderId] += report.quantity;
+    return filled;
+}
+
+// Pro-rata shares with the rounding lots going to the oldest orders, the top order's slice, icebergs sharing
+// by their displayed quantity, and self-trade prevention before the split
+void proRataAllocation()
+{
+    {
+        OrderStore store;
+        OrderBook<DenseLadder, ProRataAllocation> book(0, 1.0, 10.0, 0.05, store);
+        Reports reports;
+        Order old = makeOrder(1, 1, 'S', 4.00, 30);
+        Order newer = makeOrder(2, 2, 'S', 4.00, 70);
+        book.addOrder(old, reports);
+        book.addOrder(newer, reports);
+        Order buy = makeOrder(3, 3, 'B', 4.00, 15);
+        check(book.addOrder(buy, reports) == 15, "pro-rata fills the incoming order");
+        std::vector<int> filled = restingFills(reports, 'S', 2);
+        check(filled[1] == 5 && filled[2] == 10, "30/70 split of 15 is 5/10, the rounding lot to the oldest");
+    }
+    for (bool topOrder : {false, true}) {
+        OrderStore store;
+        std::unique_ptr<Book> book;
+        if (topOrder) book.reset(new OrderBook<DenseLadder, TopOrderProRataAllocation>(0, 1.0, 10.0, 0.05, store));
+        else book.reset(new OrderBook<DenseLadder, ProRataAllocation>(0, 1.0, 10.0, 0.05, store));
+        Reports reports;
+        Order top = makeOrder(1, 1, 'S', 4.00, 10);
+        Order second = makeOrder(2, 2, 'S', 4.00, 30);
+        Order third = makeOrder(3, 3, 'S', 4.00, 60);
+        book->addOrder(top, reports);
+        book->addOrder(second, reports);
+        book->addOrder(third, reports);
+        Order buy = makeOrder(4, 4, 'B', 4.00, 40);
+        book->addOrder(buy, reports);
+        std::vector<int> filled = restingFills(reports, 'S', 3);
+        if (topOrder) check(filled[1] == 10 && filled[2] == 10 && filled[3] == 20, "top order filled first, the rest pro-rata");
+        else check(filled[1] == 4 && filled[2] == 12 && filled[3] == 24, "no top order slice in plain pro-rata");
+    }
+    {
+        OrderStore store;
+        OrderBook<DenseLadder, ProRataAllocation> book(0, 1.0, 10.0, 0.05, store);
+        Reports reports;
+        Order iceberg = makeOrder(1, 1, 'S', 4.00, 50);
+        iceberg.displayQuantity = 10;
+        Order plain = makeOrder(2, 2, 'S', 4.00, 30);
+        book.addOrder(iceberg, reports);
+        book.addOrder(plain, reports);
+        Order buy = makeOrder(3, 3, 'B', 4.00, 39);
+        book.addOrder(buy, reports);
+        std::vector<int> filled = restingFills(reports, 'S', 2);
+        check(filled[1] == 10 && filled[2] == 29, "iceberg shares by its displayed quantity, not its reserve");
+        uint32_t index = store.clientOrders(1);
+        check(index != OrderStore::npos, "replenished iceberg still rests");
+        if (index != OrderStore::npos) book.cancel(index, reports);
+        check(reports.all.back().type == 'C' && reports.all.back().quantity == 40, "iceberg replenished from its reserve");
+    }
+    for (char selfTrade : {SelfTradeCancelOldest, SelfTradeCancelNewest}) {
+        OrderStore store;
+        OrderBook<DenseLadder, ProRataAllocation> book(0, 1.0, 10.0, 0.05, store);
+        Reports reports;
+        Order own = makeOrder(1, 1, 'S', 4.00, 30);
+        Order other = makeOrder(2, 2, 'S', 4.00, 70);
+        book.addOrder(own, reports);
+        book.addOrder(other, reports);
+        Order buy = makeOrder(1, 3, 'B', 4.00, 15, 0, selfTrade);
+        int filled = book.addOrder(buy, reports);
+        std::vector<int> fills = restingFills(reports, 'S', 2);
+        if (selfTrade == SelfTradeCancelOldest)
+            check(filled == 15 && fills[1] == 0 && fills[2] == 15, "own order cancelled, the rest goes to the others");
+        else
+            check(filled == 0 && fills[1] == 0 && fills[2] == 0 && reports.all.back().reason == SelfTradePrevented,
+                  "incoming order cancelled at its own order before the split");
+    }
+}
+
+// What print() shows of the book's best levels
+std::string printed(const Book& book)
+{
+    std::ostringstream out;
+    std::streambuf* previous = std::cout.rdbuf(out.rdbuf());
+    book.print(1);
+    std::cout.rdbuf(previous);
+    return out.str();
+}
+
+// An iceberg whose peak is used up shows its next peak at the back of its level, and the level's displayed
+// and hidden volumes follow its partial fills and its cancel
+void icebergReplenishment()
+{
+    OrderStore store;
+    OrderBook<DenseLadder> book(0, 1.0, 10.0, 0.05, store);
+    Reports reports;
+    Order iceberg = makeOrder(1, 1, 'S', 4.00, 50);
+    iceberg.displayQuantity = 10;
+    Order plain = makeOrder(2, 2, 'S', 4.00, 20);
+    book.addOrder(iceberg, reports);
+    book.addOrder(plain, reports);
+    check(printed(book).find("2\t4\t30\n") != std::string::npos, "level shows both peaks only");
+
+    Order buy = makeOrder(3, 3, 'B', 4.00, 10);
+    book.addOrder(buy, reports);
+    buy = makeOrder(3, 4, 'B', 4.00, 20);
+    book.addOrder(buy, reports);
+    std::vector<int> filled = restingFills(reports, 'S', 2);
+    check(filled[1] == 10 && filled[2] == 20, "replenished peak queues behind the order that was after it");
+
+    buy = makeOrder(3, 5, 'B', 4.00, 4);
+    book.addOrder(buy, reports);
+    check(printed(book).find("1\t4\t6\n") != std::string::npos, "partially filled peak shows what is left");
+    Order fok = makeOrder(3, 6, 'B', 4.00, 37, 'F');
+    check(book.addOrder(fok, reports) == 0, "reserve and peak add up to 36");
+
+    Order behind = makeOrder(4, 7, 'S', 4.00, 5);
+    book.addOrder(behind, reports);
+    book.cancel(store.clientOrders(1), reports);
+    check(reports.all.back().type == 'C' && reports.all.back().quantity == 36, "cancel reports peak and reserve");
+    check(printed(book).find("1\t4\t5\n") != std::string::npos, "cancel takes the peak off the level");
+    fok = makeOrder(3, 8, 'B', 4.00, 6, 'F');
+    check(book.addOrder(fok, reports) == 0, "cancel takes the reserve off the level");
+    fok = makeOrder(3, 9, 'B', 4.00, 5, 'F');
+    check(book.addOrder(fok, reports) == 5, "order behind the cancelled iceberg still fills");
+}
+
+int main()
+{
+    stopTriggeredBySweep();
+    fillOrKillWithSelfTrade();
+    uncrossReleasesOpenNotional();
+    callAuction();
+    proRataAllocation();
+    icebergReplenishment();
+    if (failures) return EXIT_FAILURE;
+    std::cout << "All order book checks passed\n";
+    return EXIT_SUCCESS;
+}
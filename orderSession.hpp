@@ -0,0 +1,344 @@
+#ifndef ORDER_SESSION_HPP
+#define ORDER_SESSION_HPP
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "protocol.hpp"
+#include "shmSession.hpp"
+
+// The clients' connection to the exchange, same API over TCP or shared memory.
+// send() and receive() may be called from two different threads (one each), like the socket before.
+// trySend() and tryReceive() are the polled alternative for a client driving the session from one thread
+// (see exchangeClient.hpp); a session is used either way, not both.
+class OrderSession {
+public:
+    virtual ~OrderSession() {}
+
+    virtual void send(const Order& order) = 0;
+
+    // Hands over as many of the orders as go without blocking, returns how many
+    virtual size_t trySend(const Order* orders, size_t count) = 0;
+
+    // Next report if a complete one has arrived, without blocking. Heartbeats are answered and dropped.
+    virtual bool tryReceive(Order& report) = 0;
+
+    // Up to timeoutMs until a report may have arrived (or, with toSend, trySend() may take more). Sessions
+    // that can only spin return at once.
+    virtual void wait(int /*timeoutMs*/, bool /*toSend*/) {}
+
+    // Messages that belong together, like a mass quote and its entries, sent in one go where the transport can
+    virtual void sendBatch(const Order* orders, size_t count)
+    {
+        for (size_t i = 0; i < count; i++) send(orders[i]);
+    }
+
+    // Blocks until the next report, throws once the exchange is gone. Heartbeats never show up here.
+    virtual void receive(Order& report) = 0;
+};
+
+// With a login (> 0) the session logs in right after connecting. If the connection drops, it connects
+// again, logs in with the last report sequence number it has seen and the exchange replays every report
+// sent in between, so neither thread of the client notices more than a delay.
+class TcpOrderSession : public OrderSession {
+public:
+    TcpOrderSession(boost::asio::io_service& ioService, const std::string& serverIP, short serverPort, int login = 0)
+        : ioService_(ioService), serverIP_(serverIP), serverPort_(serverPort), login_(login)
+    {
+        socket_ = connect();
+    }
+
+    void send(const Order& order) override
+    {
+        sendBatch(&order, 1);
+    }
+
+    // One write, so the exchange gets them in as few reads as the batch fits in
+    void sendBatch(const Order* orders, size_t count) override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (true) {
+            boost::system::error_code error;
+            if (partialSent_ < sizeof(Order)) { // Rest of a message trySend() could only send part of
+                boost::asio::write(*socket_, boost::asio::buffer(partial_.bytes + partialSent_, sizeof(Order) - partialSent_), error);
+                if (!error) partialSent_ = sizeof(Order);
+            }
+            if (!error) boost::asio::write(*socket_, boost::asio::buffer(orders, count * sizeof(Order)), error);
+            if (!error) return;
+            if (!login_) throw boost::system::system_error(error);
+            reconnect();
+        }
+    }
+
+    // Straight to the kernel with MSG_DONTWAIT, the socket itself stays blocking. A message the socket
+    // buffer only takes part of counts as sent, its rest goes first next time.
+    size_t trySend(const Order* orders, size_t count) override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (partialSent_ < sizeof(Order)) {
+            ssize_t sent = writeNow(partial_.bytes + partialSent_, sizeof(Order) - partialSent_);
+            if (sent < 0) return 0;
+            partialSent_ += sent;
+            if (partialSent_ < sizeof(Order)) return 0;
+        }
+        ssize_t sent = writeNow(orders, count * sizeof(Order));
+        if (sent <= 0) return 0;
+        size_t whole = static_cast<size_t>(sent) / sizeof(Order);
+        size_t part = static_cast<size_t>(sent) % sizeof(Order);
+        if (part == 0) return whole;
+        partial_.order = orders[whole];
+        partialSent_ = part;
+        return whole + 1;
+    }
+
+    void wait(int timeoutMs, bool toSend) override
+    {
+        if (inboxEnd_ - inboxBegin_ >= sizeof(Order)) return;
+        pollfd socket{socket_->native_handle(), static_cast<short>(POLLIN | (toSend ? POLLOUT : 0)), 0};
+        ::poll(&socket, 1, timeoutMs);
+    }
+
+    // Reads whatever the socket has into a buffer of its own and hands out the complete reports in it
+    bool tryReceive(Order& report) override
+    {
+        while (true) {
+            if (inboxEnd_ - inboxBegin_ >= sizeof(Order)) {
+                std::memcpy(&report, inbox_ + inboxBegin_, sizeof(Order));
+                inboxBegin_ += sizeof(Order);
+                if (deliver(report)) return true;
+                continue;
+            }
+            std::memmove(inbox_, inbox_ + inboxBegin_, inboxEnd_ - inboxBegin_);
+            inboxEnd_ -= inboxBegin_;
+            inboxBegin_ = 0;
+            ssize_t received = ::recv(socket_->native_handle(), inbox_ + inboxEnd_, sizeof(inbox_) - inboxEnd_, MSG_DONTWAIT);
+            if (received > 0) {
+                inboxEnd_ += received;
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return false;
+            if (!login_) throw std::runtime_error("Connection to the exchange lost");
+            std::lock_guard<std::mutex> lock(mutex_);
+            inboxBegin_ = inboxEnd_ = 0; // A report cut off by the drop is replayed whole
+            reconnect();
+            return false;
+        }
+    }
+
+    void receive(Order& report) override
+    {
+        while (true) {
+            std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                socket = socket_;
+            }
+            boost::system::error_code error;
+            boost::asio::read(*socket, boost::asio::buffer(&report, sizeof(report)), error);
+            if (error) {
+                if (!login_) throw boost::system::system_error(error);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (socket == socket_) reconnect(); // Unless send() has already done it
+                continue;
+            }
+            if (deliver(report)) return;
+        }
+    }
+
+private:
+    static const int kReconnectAttempts = 50;
+
+    boost::asio::io_service& ioService_;
+    std::string serverIP_;
+    short serverPort_;
+    int login_;
+    std::mutex mutex_;  // Guards socket_ and writes: the heartbeat answer comes from the receiving thread
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket_;
+    bool welcomed_ = false;                   // Receiving thread only
+    std::atomic<uint32_t> lastSequence_{0};   // Of the latest report passed to the client
+
+    // Polled use
+    union {
+        Order order;
+        char bytes[sizeof(Order)];
+    } partial_;                               // Message trySend() got partly out
+    size_t partialSent_ = sizeof(Order);      // Bytes of it sent, all of them when there is none
+    char inbox_[64 * sizeof(Order)];          // Received, not yet handed out: [inboxBegin_, inboxEnd_)
+    size_t inboxBegin_ = 0;
+    size_t inboxEnd_ = 0;
+
+    // False if the report is not for the client: heartbeats (answered here, the exchange closes the session
+    // if they are not, whatever the client is doing), the welcome of a reconnect and replayed reports it has
+    bool deliver(const Order& report)
+    {
+        if (report.type == 'H') {
+            send(report);
+            return false;
+        }
+        if (report.type == 'W' && welcomed_) return false; // Welcome of a reconnect, the login answer follows
+        welcomed_ = true;
+        if (report.type == 'L' && report.sequence < lastSequence_) lastSequence_ = report.sequence; // Exchange restarted, session starts over
+        if (report.sequence && report.type != 'L') {
+            if (report.sequence <= lastSequence_) return false; // Replayed, but got it before the connection dropped
+            lastSequence_ = report.sequence;
+        }
+        return true;
+    }
+
+    // With mutex_ held: bytes written without blocking, 0 if the socket buffer is full, -1 after a
+    // reconnect (or throws without a login)
+    ssize_t writeNow(const void* data, size_t size)
+    {
+        ssize_t sent = ::send(socket_->native_handle(), data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent >= 0) return sent;
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        if (!login_) throw std::runtime_error("Connection to the exchange lost");
+        reconnect();
+        return -1;
+    }
+
+    // New connection, logged in if there is a login
+    std::shared_ptr<boost::asio::ip::tcp::socket> connect()
+    {
+        auto socket = std::make_shared<boost::asio::ip::tcp::socket>(ioService_);
+        boost::asio::ip::tcp::resolver resolver(ioService_);
+        boost::asio::connect(*socket, resolver.resolve(serverIP_, std::to_string(serverPort_)));
+        socket->set_option(boost::asio::ip::tcp::no_delay(true));
+        if (login_) {
+            Order login{};
+            login.type = 'L';
+            login.orderId = login_;
+            login.sequence = lastSequence_;
+            boost::asio::write(*socket, boost::asio::buffer(&login, sizeof(login)));
+        }
+        return socket;
+    }
+
+    // With mutex_ held. Shutting the old socket down wakes the receiving thread if it is blocked on it.
+    // A message that was only partly sent goes again whole on the new connection.
+    void reconnect()
+    {
+        boost::system::error_code ignored;
+        socket_->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+        if (partialSent_ < sizeof(Order)) partialSent_ = 0;
+        for (int attempt = 1;; attempt++) {
+            try {
+                socket_ = connect();
+                return;
+            } catch (const boost::system::system_error&) {
+                if (attempt == kReconnectAttempts) throw;
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::min(100 * attempt, 1000)));
+            }
+        }
+    }
+};
+
+// Session on a slot of the exchange's shared memory segment. Only works on the exchange's host
+// and while the server runs with --shm. Both calls spin, so keep one core per busy client.
+class ShmOrderSession : public OrderSession {
+public:
+    ShmOrderSession()
+    {
+        segment_ = mapShmSegment(false);
+        if (!segment_) throw std::runtime_error("Shared memory order entry not available (is the server running with --shm?)");
+
+        for (uint32_t i = 0; i < segment_->slotCount && !slot_; i++) {
+            uint32_t expected = ShmFree;
+            if (segment_->slots[i].state.compare_exchange_strong(expected, ShmRequested, std::memory_order_acq_rel))
+                slot_ = &segment_->slots[i];
+        }
+        if (!slot_) throw std::runtime_error("No free shared memory session slot");
+        slot_->clientPid = getpid();
+
+        // The server resets the rings, assigns the client ID and queues the welcome message
+        for (int i = 0; slot_->state.load(std::memory_order_acquire) == ShmRequested; i++) {
+            if (i == kConnectTimeoutMs * 10) {
+                uint32_t expected = ShmRequested;
+                if (slot_->state.compare_exchange_strong(expected, ShmFree, std::memory_order_acq_rel))
+                    throw std::runtime_error("Exchange did not pick up the shared memory session");
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    ~ShmOrderSession() override
+    {
+        uint32_t expected = ShmActive;
+        if (!slot_->state.compare_exchange_strong(expected, ShmClosing, std::memory_order_acq_rel))
+            slot_->state.store(ShmFree, std::memory_order_release); // Dropped by the server, the slot is ours to free
+        munmap(segment_, sizeof(ShmSegment));
+    }
+
+    void send(const Order& order) override
+    {
+        for (int spins = 0; !slot_->orders.push(order); spins++) {
+            checkActive();
+            backOff(spins);
+        }
+    }
+
+    void receive(Order& report) override
+    {
+        for (int spins = 0; !slot_->reports.pop(report); spins++) {
+            checkActive();
+            backOff(spins);
+        }
+    }
+
+    size_t trySend(const Order* orders, size_t count) override
+    {
+        size_t pushed = 0;
+        while (pushed < count && slot_->orders.push(orders[pushed])) pushed++;
+        if (pushed < count) checkActive();
+        return pushed;
+    }
+
+    bool tryReceive(Order& report) override
+    {
+        if (slot_->reports.pop(report)) return true;
+        checkActive();
+        return false;
+    }
+
+private:
+    static const int kConnectTimeoutMs = 1000;
+
+    ShmSegment* segment_ = nullptr;
+    ShmSlot* slot_ = nullptr;
+
+    void checkActive()
+    {
+        if (slot_->state.load(std::memory_order_acquire) != ShmActive)
+            throw std::runtime_error("Shared memory session dropped by the exchange");
+    }
+
+    // Spin first, then let other threads on this core (the server, if it shares it) run
+    static void backOff(int spins)
+    {
+        if (spins >= 1000) std::this_thread::yield();
+#if defined(__x86_64__) || defined(__i386__)
+        else __builtin_ia32_pause();
+#endif
+    }
+};
+
+// TCP to serverIP:serverPort, or the local shared memory segment if shm is set. A login only applies to
+// TCP, shared memory sessions cannot be resumed.
+inline std::unique_ptr<OrderSession> connectOrderSession(boost::asio::io_service& ioService, const std::string& serverIP,
+                                                         short serverPort, bool shm, int login = 0)
+{
+    if (shm) return std::unique_ptr<OrderSession>(new ShmOrderSession());
+    return std::unique_ptr<OrderSession>(new TcpOrderSession(ioService, serverIP, serverPort, login));
+}
+
+#endif // ORDER_SESSION_HPP
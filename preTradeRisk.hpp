@@ -0,0 +1,149 @@
+#ifndef PRE_TRADE_RISK_HPP
+#define PRE_TRADE_RISK_HPP
+
+#include <cstdint>
+#include <vector>
+#include "protocol.hpp"
+#include "memoryPool.hpp"
+#include "orderBook.hpp"
+
+// Per client limits, 0 = no limit
+struct RiskLimits {
+    int maxOrderQuantity = 0;
+    double maxOrderNotional = 0;
+    uint32_t maxOpenOrders = 0;   // Resting orders, all instruments
+    int64_t maxPosition = 0;      // Absolute net position per instrument, counting open orders as filled
+    double creditLimit = 0;       // Net amount spent on fills plus open buy orders at their limit price
+};
+
+// Pre-trade risk checks done inline before an order reaches its book.
+// All the state a check needs is kept as running counters per client, and per client and instrument,
+// updated as orders rest, fill and are cancelled, so a check is a few array lookups however many
+// orders the client has. Open order counts come straight from the OrderStore's client lists.
+class PreTradeRisk {
+public:
+    explicit PreTradeRisk(const OrderStore& store) : store_(store) {}
+
+    // Before the first order, once the number of instruments is known
+    void setInstruments(int instruments)
+    {
+        instruments_ = instruments;
+    }
+
+    RiskLimits& defaults() { return limits_[0]; }
+
+    // Limits of clientId from now on, instead of the defaults
+    void setLimits(int clientId, const RiskLimits& limits)
+    {
+        ClientRisk& client = clientRisk(clientId);
+        if (!client.limits) {
+            client.limits = static_cast<uint32_t>(limits_.size());
+            limits_.push_back(limits);
+        } else {
+            limits_[client.limits] = limits;
+        }
+    }
+
+    // 0 if the order (B or S, valid symbol and price) passes, else the RejectReason
+    char check(const Order& order)
+    {
+        const ClientRisk& client = clientRisk(order.clientId);
+        const RiskLimits& limits = limits_[client.limits];
+        double notional = order.price * order.quantity;
+        if (limits.maxOrderQuantity && order.quantity > limits.maxOrderQuantity) return RejectOrderSize;
+        if (limits.maxOrderNotional && notional > limits.maxOrderNotional) return RejectNotional;
+        if (limits.maxOpenOrders && !immediateExecution(order.execution) && store_.clientOrderCount(order.clientId) >= limits.maxOpenOrders)
+            return RejectOpenOrders;
+
+        const InstrumentRisk& instrument = instrumentRisk(order.clientId, order.symbol);
+        if (order.type == 'B') {
+            if (limits.maxPosition && instrument.position + instrument.openBuy + order.quantity > limits.maxPosition)
+                return RejectPosition;
+            if (limits.creditLimit && client.spent + client.openBuyNotional + notional > limits.creditLimit)
+                return RejectCredit;
+        } else if (limits.maxPosition && instrument.openSell + order.quantity - instrument.position > limits.maxPosition) {
+            return RejectPosition;
+        }
+        return 0;
+    }
+
+    // What was left of a limit order after matching went into its book at its limit price
+    void onRested(const Order& order)
+    {
+        InstrumentRisk& instrument = instrumentRisk(order.clientId, order.symbol);
+        if (order.type == 'B') {
+            instrument.openBuy += order.quantity;
+            clientRisk(order.clientId).openBuyNotional += order.price * order.quantity;
+        } else {
+            instrument.openSell += order.quantity;
+        }
+    }
+
+    // Fill report (type B/S) of an order. A resting order's open counters are released at its own limitPrice,
+    // which is what onRested() booked, even when an auction uncross filled it at another price.
+    void onFill(const Order& fill, bool resting, double limitPrice = 0)
+    {
+        InstrumentRisk& instrument = instrumentRisk(fill.clientId, fill.symbol);
+        ClientRisk& client = clientRisk(fill.clientId);
+        double notional = fill.price * fill.quantity;
+        if (fill.type == 'B') {
+            instrument.position += fill.quantity;
+            client.spent += notional;
+            if (resting) {
+                instrument.openBuy -= fill.quantity;
+                client.openBuyNotional -= limitPrice * fill.quantity;
+            }
+        } else {
+            instrument.position -= fill.quantity;
+            client.spent -= notional;
+            if (resting) instrument.openSell -= fill.quantity;
+        }
+    }
+
+    // Cancel report (type C) of a resting order, quantity being what it had left, or self-trade decrement
+    // (type D), quantity being what it lost
+    void onCancel(const Order& cancel)
+    {
+        InstrumentRisk& instrument = instrumentRisk(cancel.clientId, cancel.symbol);
+        if (cancel.side == 'B') {
+            instrument.openBuy -= cancel.quantity;
+            clientRisk(cancel.clientId).openBuyNotional -= cancel.price * cancel.quantity;
+        } else {
+            instrument.openSell -= cancel.quantity;
+        }
+    }
+
+private:
+    struct ClientRisk {
+        uint32_t limits;         // Index into limits_, 0 = the defaults
+        double spent;            // Bought minus sold notional
+        double openBuyNotional;  // Resting buy orders at their limit price
+    };
+
+    struct InstrumentRisk {
+        int64_t position;  // Bought minus sold
+        int64_t openBuy;   // Resting quantity
+        int64_t openSell;
+    };
+
+    const OrderStore& store_;
+    int instruments_ = 1;
+    std::vector<RiskLimits> limits_ = std::vector<RiskLimits>(1);
+    SlabArray<ClientRisk> clients_;              // By client ID, which are handed out densely
+    SlabArray<InstrumentRisk> instrumentSlots_;  // By client ID * instruments_ + symbol
+
+    ClientRisk& clientRisk(int clientId)
+    {
+        if (clients_.capacity() <= static_cast<size_t>(clientId)) clients_.reserve(clientId + 1);
+        return clients_[clientId];
+    }
+
+    InstrumentRisk& instrumentRisk(int clientId, int symbol)
+    {
+        size_t index = static_cast<size_t>(clientId) * instruments_ + symbol;
+        if (instrumentSlots_.capacity() <= index) instrumentSlots_.reserve(index + 1);
+        return instrumentSlots_[static_cast<uint32_t>(index)];
+    }
+};
+
+#endif // PRE_TRADE_RISK_HPP
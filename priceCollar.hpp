@@ -0,0 +1,76 @@
+#ifndef PRICE_COLLAR_HPP
+#define PRICE_COLLAR_HPP
+
+#include <cmath>
+#include <cstdint>
+#include "protocol.hpp"
+
+// Dynamic price protection of one instrument, on top of the book's fixed price range.
+// The collar is a band of +-collar (a fraction) around the reference price, the last trade; an order
+// priced outside it is rejected, so a single order can never trade further than that from the last
+// trade. The circuit breaker catches a run of orders walking the price away: once a trade lands more
+// than +-breaker from the breaker's reference (the first trade, or the last trade before a halt), the
+// instrument is halted and every new order rejected for haltNs. It then resumes with the last trade as
+// the breaker's new reference. Until the first trade (or a reference set up front) nothing is checked.
+// Everything is a compare against a few cached numbers, the halt ends lazily on the next check.
+class PriceCollar {
+public:
+    PriceCollar(double collar, double breaker, int64_t haltNs) : collar_(collar), breaker_(breaker), haltNs_(haltNs) {}
+
+    // Opening price, used as both references until the first trade
+    void setReference(double price)
+    {
+        setCollarReference(price);
+        breakerReference_ = price;
+    }
+
+    double reference() const { return reference_; }
+    bool halted() const { return haltedUntil_ != 0; }
+
+    // Furthest a market order on side may trade: the collar's edge, HUGE_VAL / 0 without one
+    double marketBound(char side) const { return side == 'B' ? upperBand_ : lowerBand_; }
+
+    // 0 if an order at price may go to the book at time now, else the RejectReason
+    char check(double price, int64_t now)
+    {
+        if (haltedUntil_) {
+            if (now < haltedUntil_) return RejectHalted;
+            haltedUntil_ = 0;
+            breakerReference_ = reference_;
+        }
+        if (reference_ == 0) return 0;
+        if (price < lowerBand_) return RejectBelowCollar;
+        if (price > upperBand_) return RejectAboveCollar;
+        return 0;
+    }
+
+    // The instrument last traded at price at time now. True if that tripped the circuit breaker.
+    bool onTrade(double price, int64_t now)
+    {
+        setCollarReference(price);
+        if (breakerReference_ == 0) breakerReference_ = price;
+        if (breaker_ <= 0 || std::fabs(price - breakerReference_) <= breaker_ * breakerReference_) return false;
+        haltedUntil_ = now + haltNs_;
+        return true;
+    }
+
+private:
+    double collar_;             // Fraction of the reference, 0 = no collar
+    double breaker_;            // Fraction of the breaker reference, 0 = no circuit breaker
+    int64_t haltNs_;
+    double reference_ = 0;      // Last trade
+    double lowerBand_ = 0;      // Collar around reference_, cached so a check is two compares
+    double upperBand_ = HUGE_VAL;
+    double breakerReference_ = 0;
+    int64_t haltedUntil_ = 0;   // nowNs() the halt ends, 0 = trading
+
+    void setCollarReference(double price)
+    {
+        reference_ = price;
+        // Widened by a hair, so a price exactly on the edge of the band is not lost to rounding
+        lowerBand_ = collar_ > 0 ? price * (1 - collar_) - 1e-9 : 0;
+        upperBand_ = collar_ > 0 ? price * (1 + collar_) + 1e-9 : HUGE_VAL;
+    }
+};
+
+#endif // PRICE_COLLAR_HPP
@@ -0,0 +1,135 @@
+#ifndef PRICE_INDEX_HPP
+#define PRICE_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Price indexes track which price levels (ticks) of one book side hold orders and find the next
+// non-empty level when the best one empties. Both share the same interface so OrderBook can take
+// either as a template parameter:
+//   add(level)     level became non-empty
+//   remove(level)  level became empty
+//   next(from)     lowest non-empty level > from, -1 if none
+//   prev(from)     highest non-empty level < from, -1 if none
+
+// One byte per tick, scanned linearly. Cheapest to update and fastest for narrow, busy bands
+// such as the default 1.0 - 10.0 instrument where the next level is usually a few ticks away.
+class DenseLadder {
+public:
+    explicit DenseLadder(int levels) : occupied_(levels, 0) {}
+
+    void add(int level) { occupied_[level] = 1; }
+    void remove(int level) { occupied_[level] = 0; }
+
+    int next(int from) const
+    {
+        for (int level = from + 1; level < static_cast<int>(occupied_.size()); level++)
+            if (occupied_[level]) return level;
+        return -1;
+    }
+
+    int prev(int from) const
+    {
+        for (int level = from - 1; level >= 0; level--)
+            if (occupied_[level]) return level;
+        return -1;
+    }
+
+private:
+    std::vector<uint8_t> occupied_;
+};
+
+// Hierarchical occupancy bitmap for wide or sparse tick ranges.
+// Layer 0 has one bit per tick, every layer above has one bit per non-zero 64 bit word of the layer
+// below, up to a single top word. next()/prev() look at the current word, climb until a word has a
+// set bit on the wanted side and descend again with count-trailing/leading-zeros, so any search is
+// at most two word ops per layer: 3 layers cover 262k ticks, 4 layers 16.7M ticks.
+class BitmapLadder {
+public:
+    explicit BitmapLadder(int levels)
+    {
+        size_t bits = levels > 0 ? levels : 1;
+        do {
+            bits = (bits + 63) / 64;
+            layers_.emplace_back(bits, 0);
+        } while (bits > 1);
+    }
+
+    void add(int level)
+    {
+        uint64_t position = level;
+        for (std::vector<uint64_t>& layer : layers_) {
+            uint64_t& word = layer[position >> 6];
+            bool wasEmpty = word == 0;
+            word |= uint64_t(1) << (position & 63);
+            if (!wasEmpty) break; // Upper layers already know about this word
+            position >>= 6;
+        }
+    }
+
+    void remove(int level)
+    {
+        uint64_t position = level;
+        for (std::vector<uint64_t>& layer : layers_) {
+            uint64_t& word = layer[position >> 6];
+            word &= ~(uint64_t(1) << (position & 63));
+            if (word != 0) break; // Word still has orders, upper layers unchanged
+            position >>= 6;
+        }
+    }
+
+    int next(int from) const
+    {
+        // Climb: find the first layer with a set bit above our position in the same word
+        int64_t position = static_cast<int64_t>(from) + 1;
+        size_t depth = 0;
+        while (true) {
+            if (depth == layers_.size()) return -1;
+            const std::vector<uint64_t>& layer = layers_[depth];
+            uint64_t wordIndex = static_cast<uint64_t>(position) >> 6;
+            if (wordIndex >= layer.size()) return -1;
+            uint64_t word = layer[wordIndex] & (~uint64_t(0) << (position & 63));
+            if (word) {
+                position = static_cast<int64_t>((wordIndex << 6) | __builtin_ctzll(word));
+                break;
+            }
+            position = static_cast<int64_t>(wordIndex) + 1; // Next word at this layer = next bit one layer up
+            depth++;
+        }
+        // Descend: lowest set bit of each word below
+        while (depth-- > 0) {
+            uint64_t word = layers_[depth][position];
+            position = (position << 6) | __builtin_ctzll(word);
+        }
+        return static_cast<int>(position);
+    }
+
+    int prev(int from) const
+    {
+        int64_t position = static_cast<int64_t>(from) - 1;
+        size_t depth = 0;
+        while (true) {
+            if (position < 0 || depth == layers_.size()) return -1;
+            const std::vector<uint64_t>& layer = layers_[depth];
+            uint64_t wordIndex = static_cast<uint64_t>(position) >> 6;
+            uint64_t word = layer[wordIndex] & (~uint64_t(0) >> (63 - (position & 63)));
+            if (word) {
+                position = static_cast<int64_t>((wordIndex << 6) | (63 - __builtin_clzll(word)));
+                break;
+            }
+            position = static_cast<int64_t>(wordIndex) - 1; // Previous word at this layer = previous bit one layer up
+            depth++;
+        }
+        while (depth-- > 0) {
+            uint64_t word = layers_[depth][position];
+            position = (position << 6) | (63 - __builtin_clzll(word));
+        }
+        return static_cast<int>(position);
+    }
+
+private:
+    std::vector<std::vector<uint64_t>> layers_; // layers_[0] = one bit per tick
+};
+
+#endif // PRICE_INDEX_HPP
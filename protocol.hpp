@@ -0,0 +1,111 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+// Wire message shared by the exchange and every client.
+// It is sent as raw bytes, so all programs must be compiled against this same definition.
+struct Order {
+    int clientId;
+    int orderId;
+    int symbol;  // Instrument, index into the server's instrument list (0 = default 1.0 - 10.0 instrument)
+    char type;   // Client: B buy, S sell, M mass cancel, L login (orderId = login), Q mass quote header, its
+                 // quantity entries (type q, see below) follow. Reports: W welcome, A ack,
+                 // B/S fill, X invalid, O price rejected (see reason), R rejected by risk checks (see reason),
+                 // C cancelled, D decremented by self-trade prevention (quantity = by how much, the order stays
+                 // with the rest), T stop order triggered (the reports of the order it entered as follow),
+                 // M mass cancel done (quantity = orders cancelled), L logged in (sequence = latest report,
+                 // quantity = reports replayed before it), Q mass quote done (quantity = bids and asks entered,
+                 // displayQuantity = previous quotes replaced).
+                 // H heartbeat: sent by the exchange to a silent TCP session, the client sends it back
+    char side;   // Mass cancel: B or S to cancel one side only, 0 for both (symbol -1 for every instrument).
+                 // Cancelled ('C') and decremented ('D'): side of the order. Rejects of a quote entry: which side
+    char reason; // Rejects: RejectReason. C and D reports: SelfTradePrevented if self-trade prevention did it, else 0
+    char execution;  // B/S orders: 0 limit, rests until filled or cancelled; D day, cancelled at the end of the trading
+                     // day; G good till time, cancelled at expireTime; I immediate or cancel, F fill or kill (all or
+                     // nothing, at once); M market, immediate or cancel at the price the exchange sets from its price
+                     // protection (echoed in the ack). Unfilled I/F/M quantity is reported as C.
+    double price;
+    double stopPrice;  // B/S orders: stop order, waits until the instrument trades at or above (B) / at or below (S)
+                       // this, then enters as the order it describes: a stop with execution M, else a stop limit
+    int quantity;
+    int displayQuantity;  // B/S limit orders: iceberg, only this much of the resting quantity is shown at a time and
+                          // replenished from the rest when used up. 0 (or >= quantity): all of it is shown
+    uint32_t sequence;  // Reports of a logged in session: consecutive from 1, replayed from a given one after a
+                        // reconnect. Login ('L'): last sequence the client has seen. 0 everywhere else.
+    char selfTrade;     // B/S orders: SelfTradePrevention against the client's own resting orders, 0 = the exchange's default
+    std::time_t time;  // Using std::time_t for time representation
+    std::time_t expireTime;  // Good till time orders (execution G): wall clock time the exchange cancels them at
+
+    // Latency tracing - all values are steady clock nanoseconds (see nowNs)
+    int64_t clientSendTs;  // Stamped by the client just before sending, echoed back untouched
+    int64_t serverRecvTs;  // Server ingress: when the order (or the order that triggered this report) was read
+    int64_t serverSendTs;  // Server egress: when this report was handed to the socket
+};
+
+// Mass quote entry ('q'): a two sided quote on symbol, under the entry's orderId. The bid is price and quantity,
+// the ask stopPrice and displayQuantity; a side with quantity 0 is not quoted. selfTrade applies to both sides.
+// A mass quote replaces every quote the client has resting, in any instrument, before its entries go in.
+
+// Order::selfTrade, what happens when an order would trade against a resting order of the same client
+enum SelfTradePrevention : char {
+    SelfTradeAllow = 'A',         // The two trade
+    SelfTradeCancelNewest = 'N',  // What is left of the incoming order is cancelled
+    SelfTradeCancelOldest = 'O',  // The resting order is cancelled, matching goes on
+    SelfTradeCancelBoth = 'B',
+    SelfTradeDecrement = 'D',     // The smaller of the two is cancelled (both if equal), the larger decremented by its quantity
+};
+
+// Why an order was rejected ('O' price protection and 'R' risk reports), or cancelled / decremented ('C', 'D')
+enum RejectReason : char {
+    RejectPriceRange = 'T',  // Outside the instrument's price range or not on a tick
+    RejectBelowCollar = 'L', // Below the instrument's price collar around the last trade
+    RejectAboveCollar = 'H', // Above it
+    RejectHalted = 'S',      // Instrument halted by its circuit breaker
+    RejectClosed = 'E',      // Instrument closed while its day orders are cancelled at the end of the day
+    RejectAuction = 'A',     // Immediate or cancel, fill or kill or market order during an auction call phase
+    SelfTradePrevented = 'W', // C and D reports: the order met one of the same client on the other side
+    RejectOrderSize = 'Q',   // Quantity above the client's maximum order size
+    RejectNotional = 'N',    // Price * quantity above the client's maximum order notional
+    RejectOpenOrders = 'O',  // Client already has its maximum number of resting orders
+    RejectPosition = 'P',    // Net position could exceed the client's limit if this and its open orders filled
+    RejectCredit = 'C',      // Buying this could exceed the client's credit limit
+};
+
+// Order::execution of orders that never rest: whatever they cannot fill at once is cancelled
+inline bool immediateExecution(char execution)
+{
+    return execution == 'I' || execution == 'F' || execution == 'M';
+}
+
+inline const char* rejectReasonText(char reason)
+{
+    switch (reason) {
+    case RejectPriceRange: return "outside price range";
+    case RejectBelowCollar: return "below price collar";
+    case RejectAboveCollar: return "above price collar";
+    case RejectHalted: return "trading halted";
+    case RejectClosed: return "closed for the end of day";
+    case RejectAuction: return "not accepted in the auction call phase";
+    case SelfTradePrevented: return "self-trade prevention";
+    case RejectOrderSize: return "order size limit";
+    case RejectNotional: return "order notional limit";
+    case RejectOpenOrders: return "open orders limit";
+    case RejectPosition: return "position limit";
+    case RejectCredit: return "credit limit";
+    default: return "unknown reason";
+    }
+}
+
+// Monotonic timestamp in nanoseconds.
+// CLOCK_MONOTONIC is system wide, so client and server stamps taken on the same host are comparable;
+// across hosts only differences taken on one side (RTT, server internal) are meaningful.
+inline int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // PROTOCOL_HPP
@@ -0,0 +1,114 @@
+#ifndef REPORT_JOURNAL_HPP
+#define REPORT_JOURNAL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "protocol.hpp"
+
+// Execution reports kept for replay to sessions that reconnect (see Order::sequence).
+// The latest reports of every session stay in memory in a ReportRing; with a journal, every report
+// is also appended to one file shared by all sessions, where each record links to the previous record
+// of its session, so older reports can still be found without an index.
+
+// Append-only journal file. Writes go through a large stdio buffer, so the hot path only copies the
+// report; reads flush it first and are only done when a session is replayed.
+class ReportJournal {
+public:
+    ~ReportJournal()
+    {
+        if (file_) std::fclose(file_);
+    }
+
+    // Creates (or truncates) path, false if that fails
+    bool open(const std::string& path)
+    {
+        file_ = std::fopen(path.c_str(), "w+b");
+        if (!file_) return false;
+        buffer_.resize(1 << 20);
+        std::setvbuf(file_, buffer_.data(), _IOFBF, buffer_.size());
+        return true;
+    }
+
+    bool isOpen() const { return file_ != nullptr; }
+
+    // Append report after previous (the offset of its session's last record, -1 for none), returns its offset
+    int64_t append(const Order& report, int64_t previous)
+    {
+        Record record{report, previous};
+        std::fwrite(&record, sizeof(record), 1, file_);
+        int64_t offset = size_;
+        size_ += sizeof(record);
+        return offset;
+    }
+
+    // Calls visit(const Order&) for the reports of one session with a sequence number between after and
+    // before (both exclusive), oldest first, walking back from the record at latest. Returns how many.
+    template<typename Visitor>
+    size_t replay(int64_t latest, uint32_t after, uint32_t before, Visitor&& visit)
+    {
+        std::fflush(file_);
+        std::vector<Record> records;
+        Record record;
+        for (int64_t offset = latest; offset >= 0; offset = record.previous) {
+            if (pread(fileno(file_), &record, sizeof(record), offset) != static_cast<ssize_t>(sizeof(record))) break;
+            if (record.report.sequence <= after) break;
+            if (record.report.sequence < before) records.push_back(record);
+        }
+        std::for_each(records.rbegin(), records.rend(), [&](const Record& r) { visit(r.report); });
+        return records.size();
+    }
+
+private:
+    struct Record {
+        Order report;
+        int64_t previous;  // Offset of the previous record of the same session, -1 for its first
+    };
+
+    std::FILE* file_ = nullptr;
+    std::vector<char> buffer_;
+    int64_t size_ = 0;
+};
+
+// The latest reports of one session by sequence number, each with the offset of its journal record
+// (-1 without a journal). Sequence numbers are consecutive, so report n sits in slot n % capacity.
+class ReportRing {
+public:
+    explicit ReportRing(size_t capacity)
+        : reports_(roundUp(capacity)), offsets_(reports_.size(), -1)
+    {
+    }
+
+    // Reports are pushed in sequence order, starting at 1
+    void push(const Order& report, int64_t journalOffset)
+    {
+        size_t slot = report.sequence & (reports_.size() - 1);
+        reports_[slot] = report;
+        offsets_[slot] = journalOffset;
+        last_ = report.sequence;
+    }
+
+    // Oldest sequence number still held, last() + 1 if none
+    uint32_t first() const { return last_ >= reports_.size() ? last_ - static_cast<uint32_t>(reports_.size()) + 1 : 1; }
+    uint32_t last() const { return last_; }
+
+    const Order& at(uint32_t sequence) const { return reports_[sequence & (reports_.size() - 1)]; }
+    int64_t journalOffset(uint32_t sequence) const { return offsets_[sequence & (reports_.size() - 1)]; }
+
+private:
+    std::vector<Order> reports_;
+    std::vector<int64_t> offsets_;
+    uint32_t last_ = 0;
+
+    static size_t roundUp(size_t n)
+    {
+        size_t capacity = 1;
+        while (capacity < n) capacity <<= 1;
+        return capacity;
+    }
+};
+
+#endif // REPORT_JOURNAL_HPP
@@ -3,70 +3,1115 @@
 #include <ctime>
 #include <unordered_map>
 #include <memory>
-#include <queue>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "protocol.hpp"
+#include "latencyStats.hpp"
+#include "memoryPool.hpp"
+#include "orderBook.hpp"
+#include "ioUring.hpp"
+#include "shmSession.hpp"
+#include "timerWheel.hpp"
+#include "reportJournal.hpp"
+#include "preTradeRisk.hpp"
+#include "priceCollar.hpp"
 
 using boost::asio::ip::tcp;
 using std::shared_ptr;
 using std::make_shared;
 using std::enable_shared_from_this;
 using std::unordered_map;
-using std::priority_queue;
 using std::vector;
-using std::greater;
-using std::greater_equal;
-using std::less;
-using std::less_equal;
+using std::unique_ptr;
 using std::string;
 using std::time_t;
 using std::time;
 using std::size_t;
 using std::cout;
+using std::pair;
 
-struct Order {
-    int clientId;
-    int orderId;
-    char type;
-    double price;
-    int quantity;
-    time_t time;  // Using std::time_t for time representation
-
-    // Implementing the comparison function for the BidOrders priority_queue - MAXHEAP
-    bool operator<(const Order& other) const {
-        if (price < other.price)
-            return true;
-        else if (price == other.price)
-            return time > other.time;  // Compare by time if prices are equal
-        else
-            return false;
-    }
+// Server side latency breakdown, all values from the latency tracing fields of Order
+struct ServerStats {
+	LatencyHistogram match;    // Ingress -> order fully processed by the matching engine
+	LatencyHistogram egress;   // Ingress -> report handed to the socket (what clients see as server internal)
+	LatencyHistogram kernelRx; // Kernel RX software timestamp -> recvmsg() returned the complete order [--kernel-ts]
+	LatencyHistogram kernelTx; // sendmsg() -> kernel TX software timestamp (left the socket layer) [--kernel-ts]
 
-    // Implementing the comparison function for the AskOrders priority_queue - MINHEAP
-    bool operator>(const Order& other) const {
-        if (price > other.price)
-            return true;
-        else if (price == other.price)
-            return time > other.time;  // Compare by time if prices are equal
-        else
-            return false;
-    }
+	void print() {
+		if (match.count() == 0 && egress.count() == 0) return;
+
+		cout << "--------------------------------\n";
+		cout << "Server Latency Stats------------\n";
+		match.print("match");
+		egress.print("ingress->egress");
+		if (kernelRx.count()) kernelRx.print("kernel rx queue");
+		if (kernelTx.count()) kernelTx.print("kernel tx");
+		match.reset();
+		egress.reset();
+		kernelRx.reset();
+		kernelTx.reset();
+	}
 };
 
+// Kernel software timestamps are CLOCK_REALTIME, so compare them against realtime only
+int64_t realtimeNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Allocation accounting for --alloc-check. Every operator new in the server is counted; the hot path
+// (reading an order, matching it and writing the reports) must not allocate once warm-up is over.
+uint64_t allocationCount = 0;
+long allocCheckWarmup = -1; // Orders to process before the check is enforced, -1 = disabled
+long ordersProcessed = 0;
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+	allocationCount++;
+	if (void* pointer = std::malloc(size ? size : 1)) return pointer;
+	throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new(size_t size, std::align_val_t alignment)
+{
+	allocationCount++;
+	size_t align = static_cast<size_t>(alignment);
+	if (void* pointer = std::aligned_alloc(align, (size + align - 1) / align * align)) return pointer;
+	throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t /*size*/) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t /*alignment*/) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t /*size*/, std::align_val_t /*alignment*/) noexcept
+{
+	operator delete(pointer);
+}
+
+// Wraps one hot path handler, fails the run if it allocated after warm-up
+class HotPathScope {
+public:
+	explicit HotPathScope(const char* where) : where_(where), allocations_(allocationCount) {}
+
+	~HotPathScope()
+	{
+		if (allocCheckWarmup < 0 || ordersProcessed <= allocCheckWarmup || allocationCount == allocations_) return;
+		cout << "Alloc check failed: " << allocationCount - allocations_ << " allocation(s) in " << where_
+		     << " after " << ordersProcessed << " orders" << std::endl;
+		std::abort();
+	}
 
+private:
+	const char* where_;
+	uint64_t allocations_;
+};
 
 double lower_limit = 1.0;
 double upper_limit = 10.0;
-// Creating priority queues for bid (buy) and ask (sell) orders
-priority_queue<Order> bidOrders; // Highest bid on top
-priority_queue<Order, vector<Order>, greater<Order>> askOrders; // Lowest ask on top
+bool kernelTimestamps = false; // --kernel-ts: SO_TIMESTAMPING on every accepted socket
+size_t outboxSize = 64;        // Reports an io_uring connection batches per send, and kernel TX stamps tracked [--kernel-ts]
+bool busyPoll = false;         // --busy-poll: spin on the event loop instead of sleeping in the kernel
+int busyPollUs = 50;           // SO_BUSY_POLL budget per socket in busy-poll mode
+int socketBufferSize = 0;      // --socket-buffer: SO_RCVBUF/SO_SNDBUF of every accepted socket, 0 = kernel default
+int listenBacklog = SOMAXCONN; // --backlog: pending connection queue of each listening socket (capped by net.core.somaxconn)
+int acceptorCount = 1;         // --acceptors: listening sockets sharing the port through SO_REUSEPORT
+int acceptThreads = 0;         // --accept-threads: threads the acceptors run on, 0 = the server thread
+int serverCpu = -1;            // --cpu: CPU the server thread is pinned to
+bool cancelOnDisconnect = true; // --keep-orders: leave a client's resting orders in the book when its session ends
+size_t replayDepth = 1024;      // --replay-depth: latest reports kept in memory per logged in session
+string journalPath;             // --journal: file every report of logged in sessions is appended to, for older replays
+int heartbeatInterval = 10;    // --heartbeat: seconds a TCP session may stay silent before it is probed, and again before it is closed, 0 = off
+double collarPercent = 0;      // --collar: orders priced further than this from the last trade are rejected, 0 = off
+double breakerPercent = 0;     // --circuit-breaker: halt an instrument once it trades this far from its reference, 0 = off
+int haltSeconds = 60;          // --halt: how long a circuit breaker halt lasts
+char selfTradePrevention = SelfTradeAllow; // --self-trade: for orders that do not choose their own
+int dayEndMinute = -1;         // --day-end: local time (minutes after midnight) day orders are cancelled at, -1 = never
+int openingAuction = 0;        // --opening-auction: seconds of call phase every book starts with, and starts again with after the day end, 0 = none
+int closingAuction = 0;        // --closing-auction: seconds of call phase before the day end, 0 = none
+
+double tick_size = 0.01;
+
+// One book per instrument, the symbol of an order is its index here.
+// Symbol 0 is the default instrument: lower_limit - upper_limit on tick_size. A book's range only bounds
+// its price ladder, the price protection within it comes from the instrument's collar.
+OrderStore restingOrders; // Resting orders of every book
+vector<unique_ptr<Book>> books;
+vector<string> instrumentNames;
+vector<PriceCollar> collars; // By symbol, set up once the options are parsed
+PreTradeRisk preTradeRisk(restingOrders); // Limits: --max-order-qty, --max-notional, --max-open-orders, --max-position, --credit-limit
+unordered_map<int, RiskLimits> loginLimits; // --client-limits: limits of logged in sessions, by login
+vector<char> purging;      // By symbol: closed until the day end purge has cancelled its day orders
+int purgeSymbol = -1;      // Book the day end purge is working on, -1 = none
+std::time_t nextDayEnd = 0; // [--day-end]
+std::time_t uncrossTime = 0; // End of the auction call phase all books are in, 0 = continuous trading
+
+// Index "dense" scans a byte per tick, "bitmap" uses the hierarchical occupancy bitmap.
+// Without a choice, ranges wider than 4096 ticks get the bitmap.
+// Allocation "fifo" (or empty), "prorata" or "top-prorata"
+template<typename PriceIndex>
+Book* newBook(int symbol, double lower, double upper, double tick, const string& allocation)
+{
+	if (allocation == "prorata") return new OrderBook<PriceIndex, ProRataAllocation>(symbol, lower, upper, tick, restingOrders);
+	if (allocation == "top-prorata") return new OrderBook<PriceIndex, TopOrderProRataAllocation>(symbol, lower, upper, tick, restingOrders);
+	return new OrderBook<PriceIndex>(symbol, lower, upper, tick, restingOrders);
+}
+
+void addInstrument(const string& name, double lower, double upper, double tick, const string& index, const string& allocation = "")
+{
+	int symbol = static_cast<int>(books.size());
+	long ticks = std::lround((upper - lower) / tick) + 1;
+	bool bitmap = index == "bitmap" || (index.empty() && ticks > 4096);
+	if (bitmap)
+		books.emplace_back(newBook<BitmapLadder>(symbol, lower, upper, tick, allocation));
+	else
+		books.emplace_back(newBook<DenseLadder>(symbol, lower, upper, tick, allocation));
+	instrumentNames.push_back(name);
+	cout << "Instrument " << symbol << ": " << name << " [" << lower << " - " << upper << "] tick " << tick << ", "
+	     << ticks << " levels, " << (bitmap ? "bitmap" : "dense") << " index, "
+	     << (allocation.empty() ? "fifo" : allocation) << " allocation\n";
+}
+
+// NAME:LOWER:UPPER:TICK[:dense|bitmap][:fifo|prorata|top-prorata]
+bool addInstrument(const string& spec)
+{
+	vector<string> fields;
+	std::stringstream ss(spec);
+	string field;
+	while (std::getline(ss, field, ':')) fields.push_back(field);
+	if (fields.size() < 4 || fields.size() > 6) return false;
+
+	double lower = std::atof(fields[1].c_str());
+	double upper = std::atof(fields[2].c_str());
+	double tick = std::atof(fields[3].c_str());
+	string index, allocation;
+	for (size_t i = 4; i < fields.size(); i++) {
+		if (fields[i] == "dense" || fields[i] == "bitmap") index = fields[i];
+		else if (fields[i] == "fifo" || fields[i] == "prorata" || fields[i] == "top-prorata") allocation = fields[i];
+		else return false;
+	}
+	if (tick <= 0 || upper < lower) return false;
+
+	addInstrument(fields[0], lower, upper, tick, index, allocation);
+	return true;
+}
+ServerStats serverStats;
+
+// Socket options for every accepted connection, both transports.
+// Reports are small and latency bound, so never let Nagle hold one back waiting for an ACK.
+void tuneSocket(int fd)
+{
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (busyPoll && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs)) < 0) {
+		static bool warned = false;
+		if (!warned) cout << "SO_BUSY_POLL not available: " << strerror(errno) << "\n";
+		warned = true;
+	}
+	if (socketBufferSize > 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &socketBufferSize, sizeof(socketBufferSize));
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &socketBufferSize, sizeof(socketBufferSize));
+	}
+}
+
+// Listening socket on port for either transport. With reusePort several sockets can share the port,
+// the kernel then spreads incoming connections over them by address hash. -1 (errno set) on failure.
+int openListenSocket(short port, bool reusePort)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (reusePort) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, listenBacklog) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+// Client IDs are unique across all transports, reports are routed by them
+int generateClientId()
+{
+	static int clientIdCounter = 0;
+	return ++clientIdCounter;
+}
+
+// Session timers of every transport share one wheel, advanced from the event loop every kTimerTickMs
+const int kTimerTickMs = 100;
+
+uint64_t timerTick()
+{
+	return static_cast<uint64_t>(nowNs() / (kTimerTickMs * 1000000ll));
+}
+
+TimerWheel sessionTimers(timerTick());
+
+// Liveness of one TCP session [--heartbeat]. After heartbeatInterval without a message from the client
+// the server sends it a heartbeat ('H'), which the client answers; after another interval of silence
+// the session is closed. Reads only stamp lastReceive, the timer is moved on lazily when it fires, so
+// traffic costs nothing per message and every session costs one timer, however many there are.
+struct SessionHeartbeat {
+	enum Action { Wait, Probe, Expire };
+
+	uint64_t lastReceive = 0;                  // Timer tick of the last message from the client
+	TimerWheel::TimerId timer = TimerWheel::npos;
+	bool probed = false;                       // Heartbeat sent since lastReceive
+
+	void start(uint64_t payload)
+	{
+		if (heartbeatInterval <= 0) return;
+		lastReceive = sessionTimers.now();
+		probed = false;
+		timer = sessionTimers.schedule(lastReceive + intervalTicks(), payload);
+	}
+
+	void stop()
+	{
+		if (timer != TimerWheel::npos) sessionTimers.cancel(timer);
+		timer = TimerWheel::npos;
+	}
+
+	void onReceive()
+	{
+		lastReceive = sessionTimers.now();
+		probed = false;
+	}
+
+	// The timer fired, re-armed unless the session expired
+	Action onTimer(uint64_t payload)
+	{
+		uint64_t now = sessionTimers.now();
+		timer = TimerWheel::npos;
+		if (lastReceive + intervalTicks() > now) {
+			timer = sessionTimers.schedule(lastReceive + intervalTicks(), payload);
+			return Wait;
+		}
+		if (probed) return Expire;
+		probed = true;
+		timer = sessionTimers.schedule(now + intervalTicks(), payload);
+		return Probe;
+	}
+
+	static uint64_t intervalTicks()
+	{
+		return static_cast<uint64_t>(heartbeatInterval) * 1000 / kTimerTickMs;
+	}
+};
+
+Order heartbeatMessage(int clientId)
+{
+	Order heartbeat{};
+	heartbeat.clientId = clientId;
+	heartbeat.serverRecvTs = nowNs();
+	heartbeat.type = 'H';
+	return heartbeat;
+}
+
+// Pin the calling thread to one CPU, so busy polling keeps its caches and never migrates
+bool pinThread(int cpu)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (error) cout << "Pinning to CPU " << cpu << " failed: " << strerror(error) << "\n";
+	return error == 0;
+}
+
+// Keep the calling thread off the server's CPU [--cpu], threads inherit the affinity of their creator
+void avoidServerCpu()
+{
+	if (serverCpu < 0) return;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	for (long cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++)
+		if (cpu != serverCpu) CPU_SET(cpu, &cpus);
+	if (CPU_COUNT(&cpus) > 0) pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+void PrintOrderBook(const Order& order) {
+	cout << "Symbol " << order.symbol << " " << instrumentNames[order.symbol] << "\n";
+	books[order.symbol]->print(5);
+}
+
+// Checks against the market as it is when the order goes to its book: price protection and pre-trade risk
+bool admitOrder(Order& order, ExecutionSink& sink)
+{
+	// A market order is priced at its price protection, from there on it is an immediate or cancel order
+	if (order.execution == 'M') order.price = books[order.symbol]->marketPrice(order.type, collars[order.symbol].marketBound(order.type));
+
+	char reason;
+	if (immediateExecution(order.execution) && books[order.symbol]->inAuction()) reason = RejectAuction;
+	else if (!books[order.symbol]->validPrice(order.price)) reason = RejectPriceRange;
+	else reason = collars[order.symbol].check(order.price, order.serverRecvTs);
+	if (reason) {
+		order.type = 'O';
+		order.reason = reason;
+		sink.onReport(order);
+		return false;
+	}
+
+	if ((reason = preTradeRisk.check(order))) {
+		order.type = 'R';
+		order.reason = reason;
+		sink.onReport(order);
+		return false;
+	}
+
+	return true;
+}
+
+bool validSelfTrade(char selfTrade)
+{
+	return selfTrade == SelfTradeAllow || selfTrade == SelfTradeCancelNewest || selfTrade == SelfTradeCancelOldest ||
+	       selfTrade == SelfTradeCancelBoth || selfTrade == SelfTradeDecrement;
+}
+
+bool isvalidOrder(Order& order, ExecutionSink& sink){
+	if((order.type != 'B' && order.type != 'S') || order.symbol < 0 || order.symbol >= static_cast<int>(books.size()) ||
+	   (order.execution != 0 && order.execution != 'D' && order.execution != 'G' && !immediateExecution(order.execution)) ||
+	   (order.execution == 'G' && order.expireTime <= time(nullptr)) ||
+	   order.displayQuantity < 0 || (order.displayQuantity > 0 && immediateExecution(order.execution)) ||
+	   (order.selfTrade != 0 && !validSelfTrade(order.selfTrade)) ||
+	   order.stopPrice < 0 || (order.stopPrice > 0 && !books[order.symbol]->validPrice(order.stopPrice))) {
+		order.type = 'X';
+		sink.onReport(order);
+		return false;
+	}
+
+	// A stop order only meets the market once it triggers, until then its limit price just has to fit the book
+	if (!order.selfTrade) order.selfTrade = selfTradePrevention;
+	if (order.selfTrade == SelfTradeAllow) order.selfTrade = 0; // What the books take for no prevention
+
+	char reason = 0;
+	if (purging[order.symbol]) reason = RejectClosed; // Or it would be purged with the day that has just ended
+	else if (order.stopPrice > 0 && order.execution != 'M' && !books[order.symbol]->validPrice(order.price)) reason = RejectPriceRange;
+	if (reason) {
+		order.type = 'O';
+		order.reason = reason;
+		sink.onReport(order);
+		return false;
+	}
+
+	return order.stopPrice > 0 || admitOrder(order, sink);
+}
+
+// LOGIN:MAX_ORDER_QTY:MAX_NOTIONAL:MAX_OPEN_ORDERS:MAX_POSITION:CREDIT_LIMIT, 0 = no limit
+bool addClientLimits(const string& spec)
+{
+	vector<string> fields;
+	std::stringstream ss(spec);
+	string field;
+	while (std::getline(ss, field, ':')) fields.push_back(field);
+	if (fields.size() != 6 || std::atoi(fields[0].c_str()) <= 0) return false;
+
+	RiskLimits limits;
+	limits.maxOrderQuantity = std::atoi(fields[1].c_str());
+	limits.maxOrderNotional = std::atof(fields[2].c_str());
+	limits.maxOpenOrders = std::strtoul(fields[3].c_str(), nullptr, 10);
+	limits.maxPosition = std::atoll(fields[4].c_str());
+	limits.creditLimit = std::atof(fields[5].c_str());
+	loginLimits[std::atoi(fields[0].c_str())] = limits;
+	return true;
+}
+
+// Session of a client that logged in ('L', login in orderId). It outlives its connections: a client that
+// reconnects and logs in again gets its client ID back, so its resting orders are still its own, and has
+// every report after the last sequence number it saw replayed.
+struct LoginSession {
+	explicit LoginSession(int login, int clientId) : login(login), clientId(clientId), recent(replayDepth) {}
+
+	int login;
+	int clientId;
+	uint32_t lastSequence = 0;       // Of the latest report
+	ReportRing recent;               // The latest replayDepth reports
+	int64_t lastJournalOffset = -1;  // Journal record of the latest report [--journal]
+};
+
+class SessionTable {
+public:
+	bool openJournal(const string& path)
+	{
+		return journal_.open(path);
+	}
+
+	// Session of a logged in client, nullptr for anonymous ones
+	LoginSession* find(int clientId)
+	{
+		if (clientId <= 0 || static_cast<size_t>(clientId) >= byClient_.capacity()) return nullptr;
+		return byClient_[clientId].get();
+	}
+
+	// Stamp the report with its session's next sequence number and keep it for replay
+	void record(LoginSession& session, Order& report)
+	{
+		report.sequence = ++session.lastSequence;
+		int64_t offset = -1;
+		if (journal_.isOpen()) offset = session.lastJournalOffset = journal_.append(report, session.lastJournalOffset);
+		session.recent.push(report, offset);
+	}
+
+	// The session of login, created for clientId if it is new
+	LoginSession& login(int login, int clientId)
+	{
+		auto it = byLogin_.find(login);
+		if (it != byLogin_.end()) return *byClient_[it->second];
+		byLogin_.emplace(login, clientId);
+		byClient_.reserve(clientId + 1);
+		byClient_[clientId].reset(new LoginSession(login, clientId));
+		return *byClient_[clientId];
+	}
+
+	// Calls visit(const Order&) for every report of the session after sequence lastSeen that is still held,
+	// oldest first. Returns how many; fewer than the session has sent since lastSeen means a gap.
+	template<typename Visitor>
+	size_t replay(LoginSession& session, uint32_t lastSeen, Visitor&& visit)
+	{
+		size_t replayed = 0;
+		uint32_t first = session.recent.first();
+		if (lastSeen + 1 < first && journal_.isOpen() && first <= session.lastSequence)
+			replayed += journal_.replay(session.recent.journalOffset(first), lastSeen, first, visit);
+		for (uint32_t sequence = std::max(lastSeen + 1, first); sequence <= session.lastSequence; sequence++, replayed++)
+			visit(session.recent.at(sequence));
+		return replayed;
+	}
+
+private:
+	SlabArray<unique_ptr<LoginSession>> byClient_;  // By client ID, like the connection table
+	unordered_map<int, int> byLogin_;               // Login -> client ID
+	ReportJournal journal_;
+};
+
+SessionTable sessions;
+
+// Sink in front of a transport: stamps and keeps the reports of logged in sessions, so they can be
+// replayed even if they were produced while the client was away
+class SequencingSink : public ExecutionSink {
+public:
+	explicit SequencingSink(ExecutionSink& transport) : transport_(transport) {}
+
+	void onReport(const Order& report) override
+	{
+		LoginSession* session = sessions.find(report.clientId);
+		if (!session) {
+			transport_.onReport(report);
+			return;
+		}
+		Order sequenced(report);
+		sessions.record(*session, sequenced);
+		transport_.onReport(sequenced);
+	}
+
+private:
+	ExecutionSink& transport_;
+};
+
+// Sink keeping the pre-trade risk counters up to date with every fill and cancel on their way out.
+// The book hands reports about resting orders to onRestingReport(), so the incoming order's own fills (one
+// per price level, at that level's price, which move its position and spent notional but not its open
+// counters, as that quantity never rested), cancel (of what it could not fill without resting) and
+// self-trade decrement are never taken for those of a resting order, whatever their IDs.
+class RiskSink : public ExecutionSink {
+public:
+	explicit RiskSink(ExecutionSink& next) : next_(next) {}
+
+	void onReport(const Order& report) override
+	{
+		if (report.type == 'B' || report.type == 'S') preTradeRisk.onFill(report, false);
+		next_.onReport(report);
+	}
+
+	void onRestingReport(const Order& report, double limitPrice) override
+	{
+		if (report.type == 'B' || report.type == 'S')
+			preTradeRisk.onFill(report, true, limitPrice);
+		else if ((report.type == 'C' || report.type == 'D') && report.stopPrice == 0)
+			preTradeRisk.onCancel(report); // Not for stop orders, which are only counted once they trigger
+		next_.onReport(report);
+	}
+
+private:
+	ExecutionSink& next_;
+};
+
+// Login ('L'), answered by the transport after it bound the connection to the client ID returned here:
+// the session's own if the login is known, else a new session for the connection's current one.
+// 0 if the login is invalid (reported as 'X').
+int loginSession(Order& order, ExecutionSink& transport)
+{
+	if (order.orderId <= 0) {
+		order.type = 'X';
+		transport.onReport(order);
+		return 0;
+	}
+	LoginSession& session = sessions.login(order.orderId, order.clientId);
+	auto limits = loginLimits.find(session.login);
+	if (limits != loginLimits.end()) preTradeRisk.setLimits(session.clientId, limits->second);
+	cout << "Login " << session.login << (session.clientId == order.clientId ? " started" : " resumed")
+	     << " as client " << session.clientId << ", replay after sequence " << order.sequence << "\n";
+	return session.clientId;
+}
+
+// Once the connection is bound to the session: replay what the client missed, then acknowledge the login
+void completeLogin(const Order& login, int clientId, ExecutionSink& transport)
+{
+	LoginSession& session = *sessions.find(clientId);
+	int64_t replayTs = nowNs();
+	size_t replayed = sessions.replay(session, login.sequence, [&](const Order& report) {
+		Order replay(report);
+		replay.serverRecvTs = replayTs; // Ingress of the replay, not of the original report
+		transport.onReport(replay);
+	});
+
+	Order ack{};
+	ack.clientId = clientId;
+	ack.orderId = session.login;
+	ack.type = 'L';
+	ack.sequence = session.lastSequence;
+	ack.quantity = static_cast<int>(replayed);
+	ack.clientSendTs = login.clientSendTs;
+	ack.serverRecvTs = login.serverRecvTs;
+	transport.onReport(ack);
+}
+
+const int kMaxQuoteEntries = 256; // Entries of one mass quote
+
+// Mass quote of one client while its entries come in
+struct PendingQuote {
+	Order header;
+	vector<Order> entries;
+	bool open = false;  // Header received, entries outstanding
+};
+
+unordered_map<int, PendingQuote> pendingQuotes; // By client ID, from the client's first mass quote on
+
+// Cancel the client's resting orders, all of them or those of one symbol (-1 = any) and side (0 = both).
+// Walks the client's own order list, so it takes time proportional to that client's orders, not the book.
+int cancelClientOrders(int clientId, int symbol, char side, ExecutionSink& sink)
+{
+	int cancelled = 0;
+	uint32_t index = restingOrders.clientOrders(clientId);
+	while (index != OrderStore::npos) {
+		const ColdOrder& cold = restingOrders.cold(index);
+		uint32_t next = cold.clientNext;
+		if ((symbol < 0 || cold.symbol == symbol) && (side == 0 || cold.type == side)) {
+			books[cold.symbol]->cancel(index, sink);
+			cancelled++;
+		}
+		index = next;
+	}
+	return cancelled;
+}
+
+// Session of clientId ended, by either side. Never call this while a book is matching.
+void onSessionClosed(int clientId, ExecutionSink& transport)
+{
+	auto quote = pendingQuotes.find(clientId);
+	if (quote != pendingQuotes.end()) quote->second.open = false; // Entries of an unfinished mass quote are lost with it
+	if (!cancelOnDisconnect) return;
+	SequencingSink sequenced(transport); // A logged in client gets these cancels replayed when it comes back
+	RiskSink sink(sequenced);
+	int cancelled = cancelClientOrders(clientId, -1, 0, sink);
+	if (cancelled) cout << "Client " << clientId << " disconnected, cancelled " << cancelled << " resting orders\n";
+}
+
+// Mass cancel request ('M'), answered with an 'M' report carrying the number of orders cancelled
+void massCancel(Order& order, ExecutionSink& sink)
+{
+	if (order.symbol < -1 || order.symbol >= static_cast<int>(books.size()) ||
+	    (order.side != 0 && order.side != 'B' && order.side != 'S')) {
+		order.type = 'X';
+		sink.onReport(order);
+		return;
+	}
+	order.quantity = cancelClientOrders(order.clientId, order.symbol, order.side, sink);
+	sink.onReport(order);
+}
 
+// Match an admitted order against its book
+void executeOrder(Order& order, ExecutionSink& sink)
+{
+	int filled = books[order.symbol]->addOrder(order, sink);
+	if (order.quantity > 0) preTradeRisk.onRested(order);
+	if (filled > 0 && collars[order.symbol].onTrade(books[order.symbol]->lastTradePrice(), order.serverRecvTs))
+		cout << "Instrument " << order.symbol << " halted for " << haltSeconds << " s: traded at "
+		     << collars[order.symbol].reference() << ", circuit breaker at " << breakerPercent << "%\n";
+}
+
+// Enter the stop orders of the book that the last order's trades triggered, reported as 'T' each and then
+// admitted and matched like new orders. Trades of triggered stops can trigger more, which the book queues
+// behind them, so a cascade takes one pass however long it runs.
+void triggerStops(const Order& trigger, ExecutionSink& transport)
+{
+	Book& book = *books[trigger.symbol];
+	Order order;
+	while (book.nextTriggered(order)) {
+		order.serverRecvTs = trigger.serverRecvTs; // Ingress of the order that set it off
+		RiskSink sink(transport);
+		Order triggered(order);
+		triggered.type = 'T';
+		sink.onReport(triggered);
+		if (admitOrder(order, sink)) executeOrder(order, sink);
+	}
+}
 
-class Connection : public enable_shared_from_this<Connection> {
+// Drops every report, for the quotes a mass quote replaces
+class SilentSink : public ExecutionSink {
 public:
-    explicit Connection(boost::asio::io_service& ioService, unordered_map<int, shared_ptr<Connection>>& connections)
-        : socket_(ioService), connections_(connections)
+	void onReport(const Order&) override {}
+};
+
+// The complete mass quote replaces all of the client's quotes (resting orders with execution Q) in one go,
+// so no other order ever meets the client half requoted: the old quotes leave their books without cancel
+// reports, then every entry enters its bid and ask, each validated, risk checked and matched like a limit
+// order. Only rejected sides are reported on their own (side set), the fills as usual; one 'Q' report
+// closes the quote, quantity = sides entered, displayQuantity = quotes replaced.
+void applyMassQuote(PendingQuote& quote, ExecutionSink& transport)
+{
+	Order& header = quote.header;
+	SilentSink silent;
+	RiskSink replaced(silent); // Pre-trade risk still has to see the old quotes go
+	int pulled = 0;
+	uint32_t index = restingOrders.clientOrders(header.clientId);
+	while (index != OrderStore::npos) {
+		const ColdOrder& cold = restingOrders.cold(index);
+		uint32_t next = cold.clientNext;
+		if (cold.execution == 'Q') {
+			books[cold.symbol]->cancel(index, replaced);
+			pulled++;
+		}
+		index = next;
+	}
+
+	int entered = 0;
+	for (const Order& entry : quote.entries) {
+		for (char side : {'B', 'S'}) {
+			Order order(entry);
+			order.type = side;
+			order.side = side;
+			order.price = side == 'B' ? entry.price : entry.stopPrice;
+			order.quantity = side == 'B' ? entry.quantity : entry.displayQuantity;
+			order.stopPrice = 0;
+			order.displayQuantity = 0;
+			order.execution = 0;
+			order.serverRecvTs = header.serverRecvTs;
+			if (order.quantity <= 0) continue; // Side not quoted
+			RiskSink sink(transport);
+			if (!isvalidOrder(order, sink)) continue;
+			order.execution = 'Q';
+			executeOrder(order, sink);
+			triggerStops(order, transport);
+			entered++;
+		}
+	}
+
+	header.quantity = entered;
+	header.displayQuantity = pulled;
+	transport.onReport(header);
+	serverStats.match.record(nowNs() - header.serverRecvTs);
+}
+
+// Mass quote frames: a header ('Q', quantity = number of entries) and that many entries ('q') right after it.
+// Entries are held until the last one is in, however the transport splits them up.
+void massQuote(Order& order, ExecutionSink& transport)
+{
+	if (order.type == 'q') {
+		auto it = pendingQuotes.find(order.clientId);
+		if (it == pendingQuotes.end() || !it->second.open) {
+			order.type = 'X';
+			transport.onReport(order);
+			return;
+		}
+		PendingQuote& quote = it->second;
+		quote.entries.push_back(order);
+		if (quote.entries.size() < static_cast<size_t>(quote.header.quantity)) return;
+		quote.open = false;
+		applyMassQuote(quote, transport);
+		return;
+	}
+
+	PendingQuote& quote = pendingQuotes[order.clientId];
+	if (quote.open) { // The previous quote never got all its entries
+		quote.open = false;
+		quote.header.type = 'X';
+		transport.onReport(quote.header);
+	}
+	if (order.quantity < 0 || order.quantity > kMaxQuoteEntries) {
+		order.type = 'X';
+		transport.onReport(order);
+		return;
+	}
+	if (quote.entries.capacity() == 0) quote.entries.reserve(kMaxQuoteEntries);
+	quote.header = order;
+	quote.entries.clear();
+	quote.open = true;
+	if (order.quantity == 0) { // Nothing but the cancel of every quote
+		quote.open = false;
+		applyMassQuote(quote, transport);
+	}
+}
+
+// First time of day --day-end after now
+std::time_t dayEndAfter(std::time_t now)
+{
+	std::tm local;
+	localtime_r(&now, &local);
+	local.tm_hour = dayEndMinute / 60;
+	local.tm_min = dayEndMinute % 60;
+	local.tm_sec = 0;
+	local.tm_isdst = -1;
+	std::time_t dayEnd = mktime(&local);
+	if (dayEnd <= now) {
+		local.tm_mday++;
+		local.tm_hour = dayEndMinute / 60;
+		local.tm_min = dayEndMinute % 60;
+		local.tm_isdst = -1;
+		dayEnd = mktime(&local);
+	}
+	return dayEnd;
+}
+
+// Auctions [--opening-auction, --closing-auction]: all books go into the call phase together and are
+// uncrossed together at uncrossTime
+void startAuctions(std::time_t until)
+{
+	for (auto& book : books) book->startAuction();
+	uncrossTime = until;
+	cout << "Auction call phase for " << until - time(nullptr) << " s\n";
+}
+
+// Uncross every book in one batch each, then let the uncrossing trades trigger their stops
+void uncrossAuctions(ExecutionSink& transport)
+{
+	SequencingSink sequenced(transport);
+	RiskSink sink(sequenced);
+	int64_t now = nowNs();
+	for (size_t symbol = 0; symbol < books.size(); symbol++) {
+		Book& book = *books[symbol];
+		int volume = book.uncross(collars[symbol].reference(), now, sink);
+		if (volume == 0) continue;
+		cout << "Instrument " << symbol << " uncrossed at " << book.lastTradePrice() << ", volume " << volume << "\n";
+		if (collars[symbol].onTrade(book.lastTradePrice(), now))
+			cout << "Instrument " << symbol << " halted for " << haltSeconds << " s: uncrossed at "
+			     << collars[symbol].reference() << ", circuit breaker at " << breakerPercent << "%\n";
+		Order trigger{};
+		trigger.symbol = static_cast<int>(symbol);
+		trigger.serverRecvTs = now;
+		triggerStops(trigger, sequenced);
+	}
+	uncrossTime = 0;
+}
+
+const int kPurgeSlice = 4096; // Day orders cancelled per expireOrders() call
+
+// Called on every timer tick: runs the auction schedule, cancels the good till time orders whose time has
+// come, and from the day end on the day orders of every book. A book is closed from the day end until its day orders are gone; the
+// purge goes book by book in slices, so the transport keeps serving orders for other books in between.
+// True while the purge is not done, the transport then calls again as soon as it has polled its sockets.
+bool expireOrders(ExecutionSink& transport)
+{
+	SequencingSink sequenced(transport);
+	RiskSink sink(sequenced);
+	std::time_t now = time(nullptr);
+	if (uncrossTime && now >= uncrossTime) uncrossAuctions(transport); // The closing auction before its day orders go
+	if (closingAuction > 0 && nextDayEnd && !uncrossTime && now >= nextDayEnd - closingAuction && now < nextDayEnd)
+		startAuctions(nextDayEnd);
+	restingOrders.expire(now, [&](uint32_t index) { books[restingOrders.cold(index).symbol]->cancel(index, sink); });
+
+	if (nextDayEnd && now >= nextDayEnd) {
+		nextDayEnd = dayEndAfter(now);
+		if (openingAuction > 0) startAuctions(now + openingAuction);
+		for (size_t symbol = 0; symbol < books.size(); symbol++) {
+			if (restingOrders.dayOrders(static_cast<int>(symbol)) == OrderStore::npos) continue;
+			purging[symbol] = 1;
+			if (purgeSymbol < 0) purgeSymbol = static_cast<int>(symbol);
+		}
+	}
+
+	int budget = kPurgeSlice;
+	while (purgeSymbol >= 0 && budget > 0) {
+		uint32_t index;
+		while ((index = restingOrders.dayOrders(purgeSymbol)) != OrderStore::npos && budget > 0) {
+			books[purgeSymbol]->cancel(index, sink);
+			budget--;
+		}
+		if (index != OrderStore::npos) break;
+
+		cout << "Day end: day orders of instrument " << purgeSymbol << " cancelled\n";
+		purging[purgeSymbol] = 0;
+		do purgeSymbol++; while (purgeSymbol < static_cast<int>(books.size()) && !purging[purgeSymbol]);
+		if (purgeSymbol == static_cast<int>(books.size())) purgeSymbol = -1;
+	}
+	return purgeSymbol >= 0;
+}
+
+// Order entry shared by every transport: the transport fills in clientId, time and serverRecvTs,
+// everything else (validation, risk checks, ack, matching) happens here. Reports go to the transport, which
+// routes each one to the connection of report.clientId; those of logged in sessions are sequenced first.
+void processOrder(Order& order, ExecutionSink& transport)
+{
+	if (order.type == 'H') return; // Heartbeat answer, the transport has already taken it as a sign of life
+	SequencingSink sequenced(transport);
+	if (order.type == 'q') { // Mass quote entry: only buffered, the quote was counted and logged with its header
+		massQuote(order, sequenced);
+		return;
+	}
+	RiskSink sink(sequenced);
+
+	if (++ordersProcessed == allocCheckWarmup)
+		cout << "Alloc check: warm-up done, the hot path must not allocate from now on" << std::endl;
+	cout << "Received order: ClientID: " << order.clientId << ", OrderId: " << order.orderId << ", Type: " << order.type
+	     << ", Price: " << order.price << ", Quantity: " << order.quantity << "\n";
+
+	if (order.type == 'M') {
+		massCancel(order, sink);
+		return;
+	}
+	if (order.type == 'Q') {
+		massQuote(order, sequenced);
+		return;
+	}
+	if(!isvalidOrder(order, sink)) return;
+
+	// Acknowledge to Client that Order is placed
+	Order acknowledgeMessage(order);
+	acknowledgeMessage.type = 'A';
+	sink.onReport(acknowledgeMessage);
+
+	if (order.stopPrice > 0) books[order.symbol]->addStop(order);
+	else executeOrder(order, sink);
+	triggerStops(order, sequenced);
+	serverStats.match.record(nowNs() - order.serverRecvTs);
+
+	PrintOrderBook(order);
+}
+
+
+// Shared memory sessions [--shm]. The server thread polls the order ring of every active slot of the
+// segment between its socket polls and pushes reports straight into the client's report ring.
+class ShmGateway : public ExecutionSink {
+public:
+	// False if the segment cannot be created
+	bool open()
+	{
+		segment_ = mapShmSegment(true);
+		if (!segment_) {
+			cout << "Shared memory segment " << kShmName << " not available: " << strerror(errno) << "\n";
+			return false;
+		}
+		activeSlots_.reserve(kShmSlots);
+		clientSlots_.reserve(kShmSlots);
+		return true;
+	}
+
+	// Where reports for clients of the socket transport go
+	void setTcpSink(ExecutionSink& sink)
+	{
+		tcpSink_ = &sink;
+	}
+
+	// Deliver the report if its client is a shared memory session
+	bool deliver(const Order& report)
+	{
+		if (clientSlots_.empty()) return false;
+		auto it = clientSlots_.find(report.clientId);
+		if (it == clientSlots_.end()) return false;
+
+		Order stamped(report);
+		stamped.serverSendTs = nowNs();
+		serverStats.egress.record(stamped.serverSendTs - stamped.serverRecvTs);
+		ShmSlot& slot = segment_->slots[it->second];
+		if (!slot.reports.push(stamped)) {
+			// The client stopped reading; a report cannot be dropped silently, so drop the session
+			cout << "Shared memory client " << report.clientId << " report ring full, dropping the session\n";
+			clientSlots_.erase(it);
+			slot.state.store(ShmDropped, std::memory_order_release);
+		}
+		return true;
+	}
+
+	void onReport(const Order& report) override
+	{
+		if (!deliver(report) && tcpSink_) tcpSink_->onReport(report);
+	}
+
+	// One pass over the active sessions, called from the busy polling loop
+	void poll()
+	{
+		for (size_t i = 0; i < activeSlots_.size();) {
+			int index = activeSlots_[i];
+			if (segment_->slots[index].state.load(std::memory_order_acquire) == ShmActive) {
+				drainOrders(index);
+				i++;
+			} else {
+				deactivate(index);
+				activeSlots_[i] = activeSlots_.back();
+				activeSlots_.pop_back();
+			}
+		}
+		if (++polls_ % kScanInterval == 0) scanSlots();
+	}
+
+private:
+	static const int kBatch = 64;           // Orders taken from one session per pass, keeps sessions fair
+	static const long kScanInterval = 1024; // Passes between looks at the idle slots
+
+	ShmSegment* segment_ = nullptr;
+	ExecutionSink* tcpSink_ = nullptr;
+	vector<int> activeSlots_;              // Slots this server has activated and not yet released
+	unordered_map<int, int> clientSlots_;  // Client ID -> slot, only sessions that can still take reports
+	int slotClients_[kShmSlots] = {};      // Slot -> client ID, the server's own copy
+	long polls_ = 0;
+	int64_t nextLivenessCheck_ = 0;
+
+	void drainOrders(int index)
+	{
+		HotPathScope scope("shm");
+		ShmSlot& slot = segment_->slots[index];
+		Order order;
+		for (int i = 0; i < kBatch && slot.orders.pop(order); i++) {
+			order.serverRecvTs = nowNs();
+			order.clientId = slotClients_[index];
+			order.time = time(nullptr);
+			processOrder(order, *this);
+		}
+	}
+
+	// New sessions, and every second the slots of clients that died without closing
+	void scanSlots()
+	{
+		bool checkLiveness = nowNs() >= nextLivenessCheck_;
+		if (checkLiveness) nextLivenessCheck_ = nowNs() + 1000000000;
+
+		for (int index = 0; index < kShmSlots; index++) {
+			ShmSlot& slot = segment_->slots[index];
+			uint32_t state = slot.state.load(std::memory_order_acquire);
+			if (state == ShmRequested) {
+				activate(index);
+			} else if (checkLiveness && state != ShmFree && slot.clientPid > 0 && kill(slot.clientPid, 0) < 0 && errno == ESRCH) {
+				cout << "Shared memory client " << slotClients_[index] << " died, freeing its slot\n";
+				// poll() releases active slots
+				slot.state.store(state == ShmActive ? ShmClosing : ShmFree, std::memory_order_release);
+			}
+		}
+	}
+
+	void activate(int index)
+	{
+		ShmSlot& slot = segment_->slots[index];
+		slot.orders.reset();
+		slot.reports.reset();
+		int clientId = generateClientId();
+		slot.clientId = clientId;
+		slotClients_[index] = clientId;
+		clientSlots_.emplace(clientId, index);
+		activeSlots_.push_back(index);
+
+		// Send a welcome message to the new client
+		Order welcomeMessage{};
+		welcomeMessage.clientId = clientId;
+		welcomeMessage.serverRecvTs = nowNs();
+		welcomeMessage.serverSendTs = welcomeMessage.serverRecvTs;
+		welcomeMessage.type = 'W';
+		slot.reports.push(welcomeMessage);
+		slot.state.store(ShmActive, std::memory_order_release);
+	}
+
+	// Session left Active: closed by the client (free the slot) or dropped by us (the client frees it)
+	void deactivate(int index)
+	{
+		clientSlots_.erase(slotClients_[index]);
+		onSessionClosed(slotClients_[index], *this);
+		uint32_t expected = ShmClosing;
+		segment_->slots[index].state.compare_exchange_strong(expected, ShmFree, std::memory_order_acq_rel);
+	}
+};
+
+ShmGateway* shmGateway = nullptr; // Set with --shm
+
+// Connection memory that is only needed while reports are in flight, shared by all connections,
+// so an idle connection holds little more than its socket and its read buffer.
+ChunkedQueue<Order>::Pool reportChunks;      // Queued reports [--report-pool]
+SlabPool<HandlerMemory> writeHandlerMemory;  // asio write operation of each connection with a write in flight
+BlockPool connectionPool;                    // Connection objects together with their shared_ptr control block
+
+class Connection;
+
+// Live connections by client ID. IDs are handed out densely, so a slab array indexed by ID replaces
+// the hash map: no node per connection and a lookup is two loads. Costs a pointer pair per ID ever used.
+class ConnectionTable {
+public:
+	Connection* find(int clientId)
+	{
+		if (clientId <= 0 || static_cast<size_t>(clientId) >= connections_.capacity()) return nullptr;
+		return connections_[clientId].get();
+	}
+
+	void insert(int clientId, shared_ptr<Connection> connection)
+	{
+		connections_.reserve(clientId + 1);
+		connections_[clientId] = std::move(connection);
+	}
+
+	void erase(int clientId)
+	{
+		if (find(clientId)) connections_[clientId].reset();
+	}
+
+private:
+	SlabArray<shared_ptr<Connection>> connections_;
+};
+
+class Connection : public enable_shared_from_this<Connection>, public ExecutionSink {
+public:
+    explicit Connection(boost::asio::io_service& ioService, ConnectionTable& connections)
+        : socket_(ioService), outbox_(reportChunks), connections_(connections), txSent_(1)
     {
     }
 
+    ~Connection()
+    {
+        heartbeat_.stop();
+        if (writeMemory_ != SlabPool<HandlerMemory>::npos) writeHandlerMemory.release(writeMemory_);
+    }
+
     tcp::socket& socket()
     {
         return socket_;
@@ -82,266 +1127,1100 @@ public:
 		clientId_ = clientId;
     }
 
-	void asyncWrite()
-    {
-        auto self(shared_from_this());
-        boost::asio::async_write(socket_, boost::asio::buffer(&order_, sizeof(order_)),
-            [this, self](const boost::system::error_code& error, size_t /*bytesSent*/) {
-                if (!error) {
-                    asyncRead(); // Start reading the next order
-                } else {
-                    connections_.erase(clientId_);
-                }
-            });
-    }
+	// Once the connection is in the table, heartbeat timers look it up by client ID
+	void startHeartbeat()
+	{
+		heartbeat_.start(clientId_);
+	}
+
+	void onHeartbeatTimer()
+	{
+		switch (heartbeat_.onTimer(clientId_)) {
+		case SessionHeartbeat::Probe:
+			deliver(heartbeatMessage(clientId_));
+			break;
+		case SessionHeartbeat::Expire:
+			cout << "Client " << clientId_ << " timed out\n";
+			close();
+			break;
+		case SessionHeartbeat::Wait:
+			break;
+		}
+	}
+
+	// Outstanding operations complete with operation_aborted and drop the connection
+	void close()
+	{
+		heartbeat_.stop();
+		boost::system::error_code ignored;
+		socket_.close(ignored);
+	}
+
+	// Ask the kernel for software RX/TX timestamps (works on loopback). The TX key (OPT_ID)
+	// counts bytes from here on, so this must run before anything is written to the socket.
+	void enableKernelTimestamps()
+	{
+		int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		            SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+		if (setsockopt(socket_.native_handle(), SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+			cout << "SO_TIMESTAMPING not available: " << strerror(errno) << "\n";
+			return;
+		}
+		kernelTs_ = true;
+		txSent_ = RingQueue<pair<uint32_t, int64_t>>(outboxSize);
+		errorQueueMemory_.reset(new HandlerMemory());
+		asyncWaitTxTimestamps();
+	}
 
 	void asyncWriteToClient(const Order& order)
 	{
 		int clientId = order.clientId;
+		if (shmGateway && shmGateway->deliver(order)) return;
 
-		// Check if the client ID exists in the connections map
-		if (connections_.count(clientId) == 0) return;
+		// Check if the client ID is connected
+		Connection* connection = connections_.find(clientId);
+		if (!connection) return;
 
-		auto self(shared_from_this());
-		boost::asio::io_service& ioService = connections_[clientId]->socket().get_io_service();
-		boost::asio::async_write(connections_[clientId]->socket(), boost::asio::buffer(&order, sizeof(order)),
-		    [this, self, clientId](const boost::system::error_code& error, size_t /*bytesSent*/) {
-		        if (!error) {
-		            asyncRead(); // Start reading the next order
-		        } else {
-		            std::cout << "Write error to client: " << error.message() << std::endl;
-		            connections_.erase(clientId);
-		        }
-		    });
+		connection->deliver(order);
+	}
+
+	// Reports produced while processing this connection's order
+	void onReport(const Order& report) override
+	{
+		asyncWriteToClient(report);
+	}
+
+	// Queue a report on this connection. The queue owns the bytes until the write completes.
+	void deliver(const Order& order)
+	{
+		outbox_.push_back(order);
+		if (outbox_.size() == 1) {
+			writeMemory_ = writeHandlerMemory.allocate();
+			writeNext();
+		}
 	}
 
 private:
 	// Private members
 	tcp::socket socket_;
     Order order_;
-    unordered_map<int, shared_ptr<Connection>>& connections_;
+    ChunkedQueue<Order> outbox_;  // Holds pool chunks only while reports are queued
+    ConnectionTable& connections_;
     int clientId_;
+    SessionHeartbeat heartbeat_;
+
+	// Kernel timestamping state [--kernel-ts]
+	bool kernelTs_ = false;
+	size_t readOffset_ = 0;                  // Bytes of order_ received so far
+	int64_t kernelRxTs_ = 0;                 // Latest RX timestamp seen for order_
+	uint32_t bytesSent_ = 0;                 // Byte counter matching the kernel OPT_ID key
+	RingQueue<pair<uint32_t, int64_t>> txSent_; // Last byte key of each report -> realtime of its sendmsg()
+
+	// Recycled memory for the asio operation of each loop, so steady state reads and writes never allocate
+	HandlerMemory readMemory_;
+	uint32_t writeMemory_ = SlabPool<HandlerMemory>::npos; // Borrowed from writeHandlerMemory while the outbox is not empty
+	unique_ptr<HandlerMemory> errorQueueMemory_;          // Only with kernel timestamps
 
 	// Private methods
     void asyncRead()
     {
         auto self(shared_from_this());
-        boost::asio::async_read(socket_, boost::asio::buffer(&order_, sizeof(order_)),
+        if (kernelTs_) {
+            // async_read would drop the control messages, so wait for readability and recvmsg() ourselves
+            socket_.async_wait(tcp::socket::wait_read, makeCustomAllocHandler(readMemory_,
+                [this, self](const boost::system::error_code& error) {
+                    if (error) handleRead(error);
+                    else readWithTimestamps();
+                }));
+            return;
+        }
+        boost::asio::async_read(socket_, boost::asio::buffer(&order_, sizeof(order_)), makeCustomAllocHandler(readMemory_,
             [this, self](const boost::system::error_code& error, size_t /*bytesRead*/) {
                 handleRead(error);
-            });
+            }));
     }
 
+	void readWithTimestamps()
+	{
+		char* data = reinterpret_cast<char*>(&order_);
+		while (readOffset_ < sizeof(order_)) {
+			iovec iov{data + readOffset_, sizeof(order_) - readOffset_};
+			char control[256];
+			msghdr msg{};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+
+			ssize_t bytesRead = ::recvmsg(socket_.native_handle(), &msg, MSG_DONTWAIT);
+			if (bytesRead > 0) {
+				readOffset_ += bytesRead;
+				// For TCP the timestamp is the one of the last segment consumed
+				for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+					if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+						const timespec& ts = reinterpret_cast<scm_timestamping*>(CMSG_DATA(cmsg))->ts[0];
+						kernelRxTs_ = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+					}
+				}
+			}
+			else if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				asyncRead(); // Partial order, wait for the rest
+				return;
+			}
+			else {
+				readOffset_ = 0;
+				handleRead(bytesRead == 0 ? boost::asio::error::eof
+				                          : boost::system::error_code(errno, boost::system::system_category()));
+				return;
+			}
+		}
+
+		readOffset_ = 0;
+		if (kernelRxTs_) serverStats.kernelRx.record(realtimeNs() - kernelRxTs_);
+		kernelRxTs_ = 0;
+		handleRead(boost::system::error_code());
+	}
+
+	// TX timestamps are queued on the socket error queue and signalled as EPOLLERR
+	void asyncWaitTxTimestamps()
+	{
+		auto self(shared_from_this());
+		socket_.async_wait(tcp::socket::wait_error, makeCustomAllocHandler(*errorQueueMemory_,
+		    [this, self](const boost::system::error_code& error) {
+		        if (error) return;
+		        HotPathScope scope("tx timestamps");
+		        drainTxTimestamps();
+		        asyncWaitTxTimestamps();
+		    }));
+	}
+
+	void drainTxTimestamps()
+	{
+		while (true) {
+			char control[256];
+			msghdr msg{};
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			if (::recvmsg(socket_.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+			int64_t txTs = 0;
+			bool haveKey = false;
+			uint32_t key = 0;
+			for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+					const timespec& ts = reinterpret_cast<scm_timestamping*>(CMSG_DATA(cmsg))->ts[0];
+					txTs = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+				}
+				else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+				         (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+					const sock_extended_err* err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cmsg));
+					if (err->ee_errno == ENOMSG && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+						key = err->ee_data;
+						haveKey = true;
+					}
+				}
+			}
+			if (!txTs || !haveKey) continue;
+
+			// Reports are sent in order, anything older than the key will not get its own timestamp
+			while (!txSent_.empty() && static_cast<int32_t>(txSent_.front().first - key) < 0) txSent_.pop_front();
+			if (!txSent_.empty() && txSent_.front().first == key) {
+				serverStats.kernelTx.record(txTs - txSent_.front().second);
+				txSent_.pop_front();
+			}
+		}
+	}
+
+	// The queued reports of the front chunk (up to 8) go out in one write. With TCP_NODELAY every write
+	// is a segment of its own, so one write per report would cost a segment per report. A gather write
+	// over several chunks would not fit the asio operation in its HandlerMemory block.
+	void writeNext()
+	{
+		auto self(shared_from_this());
+		boost::asio::const_buffer buffer;
+		int64_t sendTs = nowNs();
+		size_t reports = outbox_.visitRuns(1, [&](Order* orders, size_t count) {
+			for (size_t i = 0; i < count; i++) {
+				orders[i].serverSendTs = sendTs;
+				serverStats.egress.record(sendTs - orders[i].serverRecvTs);
+			}
+			buffer = boost::asio::buffer(orders, count * sizeof(Order));
+		});
+		if (kernelTs_) {
+			bytesSent_ += reports * sizeof(Order);
+			txSent_.emplace_back(bytesSent_ - 1, realtimeNs());
+		}
+		boost::asio::async_write(socket_, buffer, makeCustomAllocHandler(writeHandlerMemory[writeMemory_],
+		    [this, self, reports](const boost::system::error_code& error, size_t /*bytesSent*/) {
+		        HotPathScope scope("write");
+		        if (!error) {
+		            if (kernelTs_) drainTxTimestamps(); // Loopback stamps synchronously, pick them up right away
+		            outbox_.pop_front(reports);
+		            if (!outbox_.empty()) {
+		                writeNext();
+		            } else {
+		                writeHandlerMemory.release(writeMemory_);
+		                writeMemory_ = SlabPool<HandlerMemory>::npos;
+		            }
+		        } else {
+		            if (error != boost::asio::error::operation_aborted)
+		                std::cout << "Write error to client: " << error.message() << std::endl;
+		            drop();
+		        }
+		    }));
+	}
+
 	void handleRead(const boost::system::error_code& error)
     {
+        HotPathScope scope("read");
         if (!error) {
+			order_.serverRecvTs = nowNs();
 			order_.clientId = clientId_;
 			order_.time = time(nullptr);
-            cout << "Received order: ClientID: " << order_.clientId << ", OrderId: " << order_.orderId << ", Type: " << order_.type
-                      << ", Price: " << order_.price << ", Quantity: " << order_.quantity << "\n";
-			
-			if(!isvalidOrder()) return;		
+			heartbeat_.onReceive();
+			if (order_.type == 'L') login();
+			else processOrder(order_, *this);
 
-			handleOrders();
-
-			PrintOrderBook();
+			asyncRead(); // Start reading the next order
         } else {
-            connections_.erase(clientId_);
+            drop();
         }
     }
 
-	void handleOrders(){
-
-		// Acknowledge to Client that Order is placed
-		Order acknowledgeMessage(order_);
-		acknowledgeMessage.type = 'A';
-        asyncWriteToClient(acknowledgeMessage);
-
-		Order placedOrder = order_;
-		if(order_.type == 'B'){
-			handleOrdersHelper(askOrders, bidOrders, greater_equal<double>());
-		}
-		else if(order_.type == 'S'){
-			handleOrdersHelper(bidOrders, askOrders, less_equal<double>());
+	// Bind this connection to the login's session, taking the session over from a connection still holding it
+	void login()
+	{
+		int clientId = loginSession(order_, *this);
+		if (!clientId) return;
+		if (clientId != clientId_) {
+			onSessionClosed(clientId_, *this); // Orders sent before the login
+			Connection* holder = connections_.find(clientId);
+			shared_ptr<Connection> previous = holder ? holder->shared_from_this() : nullptr;
+			heartbeat_.stop();
+			connections_.erase(clientId_);
+			clientId_ = clientId;
+			connections_.insert(clientId_, shared_from_this());
+			heartbeat_.start(clientId_);
+			if (previous) {
+				cout << "Client " << clientId_ << " taken over by a new connection\n";
+				previous->close();
+			}
 		}
-
+		completeLogin(order_, clientId_, *this);
 	}
-		
-	bool isvalidOrder(){
-		if(order_.type != 'B' && order_.type != 'S') {
-			order_.type = 'X';
-			asyncWrite();
-			return false;
-		}
-
-		if(order_.price > upper_limit ||  order_.price < lower_limit) {
-			order_.type = 'O';
-			asyncWrite();
-			return false;
-		}
 
-		return true;
-	}
-	
-	template<typename OppositeBook,typename OwnBook,typename CompareOperator>
-	void handleOrdersHelper(OppositeBook &oppositeBook, OwnBook &ownBook, CompareOperator compare){
-		Order placedOrder = order_;
-		double total_cost = matching(order_, oppositeBook, compare); // Order is now representing remaining order
-		placedOrder.quantity -= order_.quantity; // Order.quantity = remaining quanity - This will give placed quantities
-		
-		// Send Placed Order Details to client
-		if(placedOrder.quantity>0){
-			
-			placedOrder.price = total_cost/(double)placedOrder.quantity;
-			asyncWriteToClient(placedOrder);
-		}
-		
-		if(order_.quantity>0)
-			ownBook.push(order_);
+	// Read or write failed (or the socket was closed), reports for this client go nowhere from now on
+	void drop()
+	{
+		if (connections_.find(clientId_) != this) return; // Dropped already, or the session moved on to a new connection
+		heartbeat_.stop();
+		connections_.erase(clientId_);
+		onSessionClosed(clientId_, *this);
 	}
 
-	template<typename OppositeBook, typename CompareOperator>
-	double matching(Order &order, OppositeBook &oppositeBook, CompareOperator compare){
-		if(oppositeBook.empty()){
-			return 0;
-		}
+};
 
-		Order topOrder = oppositeBook.top();
 
-		if(compare(order.price, topOrder.price)){
+// One listening socket. Once it is readable every pending connection (up to kAcceptBatch) is taken off
+// the backlog in one go and handed over as a batch, instead of one accept per handler invocation.
+class Acceptor {
+public:
+	typedef std::function<void(const int* fds, size_t count)> Handler;
 
-			double total_cost;			
+	Acceptor(boost::asio::io_service& ioService, int listenFd, Handler handler)
+		: acceptor_(ioService, tcp::v4(), listenFd), backoff_(ioService), handler_(std::move(handler))
+	{
+		acceptor_.non_blocking(true);
+		asyncAccept();
+	}
 
-			if(order.quantity >= topOrder.quantity){ 
-				//Buyer received ask price and ask quantities.
-				// Total cost of Matched order
-				total_cost = topOrder.price * static_cast<double>(topOrder.quantity);
+private:
+	static const size_t kAcceptBatch = 64;
+	static const int kBackoffMs = 100; // Pause after running out of fds or memory, the backlog waits meanwhile
 
-				// Update OrderBook
-				oppositeBook.pop();
+	tcp::acceptor acceptor_;
+	boost::asio::steady_timer backoff_;
+	Handler handler_;
+	bool exhausted_ = false; // Out of fds or memory since the last accept that worked, logged once
 
-				// Update Current order
-				order.quantity -= topOrder.quantity;
-			}
-			else{ 
-				// Buyer received ask price and bid quantities with no remaining quantities.
-				// Total cost of Matched order
-				total_cost = topOrder.price * static_cast<double>(order.quantity);
-
-				// Update OrderBook
-				Order remainingOrder = topOrder;
-				remainingOrder.quantity -= order.quantity;
-				oppositeBook.pop();
-				oppositeBook.push(remainingOrder);
-
-				// Update the Matched Orders
-				topOrder.quantity = order.quantity;
-				order.quantity = 0;
+	void asyncAccept()
+	{
+		acceptor_.async_wait(tcp::acceptor::wait_read, [this](const boost::system::error_code& error) {
+			if (error) return;
+			if (acceptBatch()) {
+				asyncAccept();
+				return;
 			}
-
-			if(topOrder.quantity!=0) /*Bug Fix*/
-				asyncWriteToClient(topOrder);
-			if(order.quantity!=0)
-				total_cost += matching(order, oppositeBook, compare);
-			
-			return total_cost;
-		}
-		
-		return 0; // If Bid Price is less than ask price
+			// The listen socket stays readable, waiting on it again would spin
+			backoff_.expires_from_now(std::chrono::milliseconds(kBackoffMs));
+			backoff_.async_wait([this](const boost::system::error_code& error) {
+				if (!error) asyncAccept();
+			});
+		});
 	}
-	
-	void PrintOrderBook() {
-		PrintOrderBookHelper(askOrders, "Top 5 Best Asks");
-		PrintOrderBookHelper(bidOrders, "Top 5 Best Bids");
-	}
-		
-	template<typename PriorityQueue>
-	void PrintOrderBookHelper(const PriorityQueue& orders, const string& title) {
-		PriorityQueue temp = orders;
-		
-		cout << "--------------------------------\n";
-		cout << title << "-----------------\n";
-		cout << "Orders\tPrice\tVolume\n";
-		
-		int limit = 5;
-		while (!temp.empty() && limit--) {
-		    typename PriorityQueue::value_type tempOrder = temp.top();
-		    int orderCount = 0;
-		    int volume = 0;
-		    
-		    while (!temp.empty() && temp.top().price == tempOrder.price) {
-		        typename PriorityQueue::value_type tempOrderInner = temp.top();
-		        orderCount++;
-		        volume += tempOrderInner.quantity;
-		        temp.pop();
-		    }
-		    
-		    cout << orderCount << "\t" << tempOrder.price << "\t" << volume << "\n";
+
+	// False if accepting failed for lack of fds or memory, with connections still waiting in the backlog
+	bool acceptBatch()
+	{
+		int fds[kAcceptBatch];
+		size_t count = 0;
+		bool exhausted = false;
+		while (count < kAcceptBatch) {
+			int fd = accept4(acceptor_.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				exhausted = errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM;
+				if (exhausted && !exhausted_)
+					cout << "Accept failed: " << strerror(errno) << ", retrying every " << kBackoffMs << " ms\n";
+				break; // EAGAIN: backlog drained
+			}
+			tuneSocket(fd);
+			fds[count++] = fd;
 		}
+		if (count) handler_(fds, count);
+		exhausted_ = exhausted;
+		return !exhausted;
 	}
 };
 
+// Thread running acceptors off the server thread [--accept-threads]. Accepting and socket setup
+// happen here, the server thread only adopts the ready sockets, a batch per posted handler.
+class AcceptThread {
+public:
+	AcceptThread() : work_(new boost::asio::io_service::work(ioService_)) {}
+
+	~AcceptThread()
+	{
+		work_.reset();
+		ioService_.stop();
+		if (thread_.joinable()) thread_.join();
+	}
+
+	boost::asio::io_service& ioService()
+	{
+		return ioService_;
+	}
+
+	void start()
+	{
+		thread_ = std::thread([this] {
+			avoidServerCpu();
+			ioService_.run();
+		});
+	}
+
+private:
+	boost::asio::io_service ioService_;
+	unique_ptr<boost::asio::io_service::work> work_;
+	std::thread thread_;
+};
 
-class Server {
+class Server : public ExecutionSink {
 public:
-    Server(boost::asio::io_service& ioService, short port)
-        : acceptor_(ioService, tcp::endpoint(tcp::v4(), port))
+    Server(boost::asio::io_service& ioService, short port, int statsInterval)
+        : ioService_(ioService), statsTimer_(ioService), tickTimer_(ioService), statsInterval_(statsInterval)
+    {
+        // Acceptor i runs on accept thread i % acceptThreads, or on the server thread
+        for (int i = 0; i < acceptThreads; i++) acceptThreads_.emplace_back(new AcceptThread());
+        for (int i = 0; i < acceptorCount; i++) {
+            int listenFd = openListenSocket(port, acceptorCount > 1);
+            if (listenFd < 0) throw std::runtime_error("Listening on port " + std::to_string(port) + " failed: " + strerror(errno));
+            if (acceptThreads_.empty()) {
+                acceptors_.emplace_back(new Acceptor(ioService, listenFd, [this](const int* fds, size_t count) {
+                    addConnections(fds, count);
+                }));
+            } else {
+                acceptors_.emplace_back(new Acceptor(acceptThreads_[i % acceptThreads_.size()]->ioService(), listenFd,
+                    [this](const int* fds, size_t count) {
+                        ioService_.post([this, batch = vector<int>(fds, fds + count)] { addConnections(batch.data(), batch.size()); });
+                    }));
+            }
+        }
+        if (!acceptThreads_.empty()) {
+            acceptWork_.reset(new boost::asio::io_service::work(ioService)); // Keeps run() going until the first batch arrives
+            for (auto& thread : acceptThreads_) thread->start();
+        }
+        if (statsInterval_ > 0) startStatsTimer();
+        startTimerTick();
+    }
+
+    ~Server()
+    {
+        acceptThreads_.clear(); // Joins them before their acceptors go away
+    }
+
+    // Reports produced outside a Connection (orders of shared memory sessions, expiries)
+    void onReport(const Order& report) override
     {
-        startAccept();
+        if (shmGateway && shmGateway->deliver(report)) return;
+        Connection* connection = connections_.find(report.clientId);
+        if (connection) connection->deliver(report);
     }
 
 private:
 	// Private members
-	tcp::acceptor acceptor_;
-    unordered_map<int, shared_ptr<Connection>> connections_;
+	boost::asio::io_service& ioService_;
+    ConnectionTable connections_;
+	vector<unique_ptr<AcceptThread>> acceptThreads_;
+	vector<unique_ptr<Acceptor>> acceptors_;
+	unique_ptr<boost::asio::io_service::work> acceptWork_;
+	boost::asio::steady_timer statsTimer_;
+	boost::asio::steady_timer tickTimer_;
+	HandlerMemory tickMemory_;
+	HandlerMemory purgeMemory_;
+	int statsInterval_;
 	
 	// Private methods
-    void startAccept()
-    {
-        auto newConnection = make_shared<Connection>(acceptor_.get_io_service(), connections_);
-        acceptor_.async_accept(newConnection->socket(),
-            [this, newConnection](const boost::system::error_code& error) {
-                handleAccept(newConnection, error);
-            });
-    }
-
-	void handleAccept(shared_ptr<Connection> connection, const boost::system::error_code& error)
+	// Sockets accepted (and tuned) by an acceptor, in the server thread
+	void addConnections(const int* fds, size_t count)
 	{
-		if (!error) {
+		for (size_t i = 0; i < count; i++) {
+		    auto connection = std::allocate_shared<Connection>(PoolAllocator<Connection>(connectionPool), ioService_, connections_);
+		    boost::system::error_code error;
+		    connection->socket().assign(tcp::v4(), fds[i], error);
+		    if (error) {
+		        close(fds[i]);
+		        continue;
+		    }
+		    if (kernelTimestamps) connection->enableKernelTimestamps();
 		    connection->start();
 
 			// Generate a unique client ID and assign it to the new connection
             int clientId = generateClientId();
             connection->setClientID(clientId);
-            connections_.emplace(clientId, connection);
+            connections_.insert(clientId, connection);
+            connection->startHeartbeat();
 
 		    // Send a welcome message to the new client
-			Order welcomeMessage;
+			Order welcomeMessage{};
 			welcomeMessage.clientId = clientId;
+			welcomeMessage.serverRecvTs = nowNs();
 			welcomeMessage.type = 'W';
 			connection->asyncWriteToClient(welcomeMessage);
 		}
+	}
 
-		startAccept();
+	// One asio timer advances the session timer wheel for all connections and expires orders
+	void startTimerTick()
+	{
+		tickTimer_.expires_after(std::chrono::milliseconds(kTimerTickMs));
+		tickTimer_.async_wait(makeCustomAllocHandler(tickMemory_, [this](const boost::system::error_code& error) {
+			if (error) return;
+			sessionTimers.advance(timerTick(), [this](uint64_t clientId) {
+				Connection* connection = connections_.find(static_cast<int>(clientId));
+				if (connection) connection->onHeartbeatTimer();
+			});
+			if (expireOrders(*this)) continuePurge();
+			startTimerTick();
+		}));
 	}
 
-	int generateClientId()
-    {
-        static int clientIdCounter = 0;
-        return ++clientIdCounter;
-    }
+	// Next slice of the day end purge, queued behind the socket events that are ready by now
+	void continuePurge()
+	{
+		ioService_.post(makeCustomAllocHandler(purgeMemory_, [this] {
+			if (expireOrders(*this)) continuePurge();
+		}));
+	}
+
+	// Periodically dump and reset the latency histograms
+	void startStatsTimer()
+	{
+		statsTimer_.expires_after(std::chrono::seconds(statsInterval_));
+		statsTimer_.async_wait([this](const boost::system::error_code& error) {
+			if (error) return;
+			serverStats.print();
+			startStatsTimer();
+		});
+	}
+
+};
+
+// io_uring transport [--io-uring]. Same order flow as Server/Connection, only the socket handling
+// differs: one multishot accept, one multishot receive per connection filling buffers from a
+// provided buffer ring, and every send/re-arm of a loop iteration submitted with a single syscall.
+class UringServer : public ExecutionSink {
+public:
+	UringServer(short port, int statsInterval) : port_(port), statsInterval_(statsInterval) {}
+
+	~UringServer()
+	{
+		for (int listenFd : listenFds_) close(listenFd);
+	}
+
+	// False if io_uring (or multishot / buffer rings) is not available, the caller falls back to asio
+	bool start()
+	{
+		if (!ring_.init(4096, 16384)) {
+			cout << "io_uring not available: " << strerror(errno) << "\n";
+			return false;
+		}
+		if (!ring_.setupBufferRing(kBufferGroup, kBufferCount, kBufferSize)) {
+			cout << "io_uring provided buffer ring not available: " << strerror(errno) << "\n";
+			return false;
+		}
+
+		// Multishot accepts already take every pending connection per wakeup, extra acceptors only
+		// spread the backlog over several sockets
+		for (int i = 0; i < acceptorCount; i++) {
+			int listenFd = openListenSocket(port_, acceptorCount > 1);
+			if (listenFd < 0) {
+				cout << "io_uring listen on port " << port_ << " failed: " << strerror(errno) << "\n";
+				return false;
+			}
+			listenFds_.push_back(listenFd);
+		}
+
+		dirty_.reserve(1024);
+		clientFds_.reserve(1024);
+		for (int listenFd : listenFds_) armAccept(listenFd);
+		if (statsInterval_ > 0) armStatsTimer();
+		armTickTimer();
+		return true;
+	}
+
+	void run()
+	{
+		while (true) {
+			flushSends();
+			if (ring_.submit(busyPoll || purgePending_ ? 0 : 1, busyPoll) < 0 && errno != EBUSY && errno != EAGAIN) {
+				cout << "io_uring_enter failed: " << strerror(errno) << "\n";
+				return;
+			}
+			ring_.reap([this](const io_uring_cqe& cqe) { handleCompletion(cqe); });
+			ring_.publishBuffers(); // Hand every buffer consumed in this batch back to the kernel at once
+			if (shmGateway) shmGateway->poll();
+			if (purgePending_) purgePending_ = expireOrders(*this); // Next slice, without waiting for a completion
+		}
+	}
+
+	// Reports are only queued here, flushSends() writes each connection's batch with one send
+	void onReport(const Order& report) override
+	{
+		if (shmGateway && shmGateway->deliver(report)) return;
+		auto it = clientFds_.find(report.clientId);
+		if (it == clientFds_.end()) return;
+
+		UringConnection& connection = connections_[it->second];
+		connection.pending.push_back(report);
+		if (!connection.dirty) {
+			connection.dirty = true;
+			dirty_.push_back(it->second);
+		}
+	}
+
+private:
+	static const uint16_t kBufferGroup = 0;
+	static const unsigned kBufferCount = 1024; // Power of two
+	static const unsigned kBufferSize = 4096;
+
+	// user_data of every SQE: operation << 56 | connection generation << 32 | fd
+	enum Operation : uint64_t { Accept = 1, Receive, Send, StatsTimer, TickTimer };
+
+	struct UringConnection {
+		bool open = false;
+		bool dirty = false;        // On dirty_, pending has reports to flush
+		bool sending = false;      // A send of inflight is outstanding
+		int clientId = 0;
+		uint32_t generation = 0;   // Bumped per accept, so completions of a previous socket on this fd are ignored
+		int pendingOps = 0;        // Receive + send in the kernel, the fd is closed once a closed connection drops to 0
+		Order order;               // Order being reassembled from the byte stream
+		size_t orderBytes = 0;     // Bytes of order received so far
+		vector<Order> pending;     // Reports queued since the last flush
+		vector<Order> inflight;    // Reports handed to the kernel, must stay put until the send completes
+		size_t inflightOffset = 0; // Bytes of inflight already sent
+		SessionHeartbeat heartbeat;  // Timer payload: generation << 32 | fd
+	};
+
+	short port_;
+	int statsInterval_;
+	vector<int> listenFds_;
+	IoUring ring_;
+	vector<UringConnection> connections_;   // Indexed by fd
+	unordered_map<int, int> clientFds_;     // Client ID -> fd
+	vector<int> dirty_;                     // Connections with reports to flush
+	__kernel_timespec statsTimeout_{};
+	__kernel_timespec tickTimeout_{};
+	bool purgePending_ = false;             // Day end purge under way, expireOrders() runs every loop iteration
+
+	static uint64_t userData(Operation operation, uint32_t generation, int fd)
+	{
+		return (static_cast<uint64_t>(operation) << 56) | (static_cast<uint64_t>(generation & 0xffffff) << 32) | static_cast<uint32_t>(fd);
+	}
+
+	io_uring_sqe* getSqe()
+	{
+		io_uring_sqe* sqe = ring_.getSqe();
+		if (!sqe) {
+			cout << "io_uring submission queue full\n";
+			std::abort();
+		}
+		return sqe;
+	}
+
+	void armAccept(int listenFd)
+	{
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = listenFd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		sqe->user_data = userData(Accept, 0, listenFd);
+	}
+
+	void armReceive(int fd)
+	{
+		UringConnection& connection = connections_[fd];
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = ring_.bufferGroup();
+		sqe->user_data = userData(Receive, connection.generation, fd);
+		connection.pendingOps++;
+	}
+
+	void armSend(int fd)
+	{
+		UringConnection& connection = connections_[fd];
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uint64_t>(reinterpret_cast<char*>(connection.inflight.data()) + connection.inflightOffset);
+		sqe->len = static_cast<uint32_t>(connection.inflight.size() * sizeof(Order) - connection.inflightOffset);
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = userData(Send, connection.generation, fd);
+		connection.pendingOps++;
+	}
+
+	void armStatsTimer()
+	{
+		statsTimeout_.tv_sec = statsInterval_;
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = reinterpret_cast<uint64_t>(&statsTimeout_);
+		sqe->len = 1;
+		sqe->user_data = userData(StatsTimer, 0, 0);
+	}
+
+	void armTickTimer()
+	{
+		tickTimeout_.tv_nsec = kTimerTickMs * 1000000ll;
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = reinterpret_cast<uint64_t>(&tickTimeout_);
+		sqe->len = 1;
+		sqe->user_data = userData(TickTimer, 0, 0);
+	}
+
+	void handleCompletion(const io_uring_cqe& cqe)
+	{
+		Operation operation = static_cast<Operation>(cqe.user_data >> 56);
+		uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32) & 0xffffff;
+		int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+
+		switch (operation) {
+		case Accept:
+			handleAccept(fd, cqe);
+			break;
+		case Receive:
+			handleReceive(fd, generation, cqe);
+			break;
+		case Send:
+			handleSend(fd, generation, cqe);
+			break;
+		case StatsTimer:
+			serverStats.print();
+			armStatsTimer();
+			break;
+		case TickTimer:
+			sessionTimers.advance(timerTick(), [this](uint64_t payload) { handleHeartbeatTimer(payload); });
+			purgePending_ = expireOrders(*this);
+			armTickTimer();
+			break;
+		}
+	}
+
+	void handleAccept(int listenFd, const io_uring_cqe& cqe)
+	{
+		if (!(cqe.flags & IORING_CQE_F_MORE)) armAccept(listenFd); // Multishot accept was terminated, re-arm it
+		if (cqe.res < 0) {
+			cout << "io_uring accept failed: " << strerror(-cqe.res) << "\n";
+			return;
+		}
+
+		int fd = cqe.res;
+		tuneSocket(fd);
+		if (static_cast<size_t>(fd) >= connections_.size()) connections_.resize(fd + 1024);
+		UringConnection& connection = connections_[fd];
+		connection.open = true;
+		connection.dirty = false;
+		connection.sending = false;
+		connection.clientId = generateClientId();
+		connection.generation++;
+		connection.orderBytes = 0;
+		connection.pending.reserve(outboxSize);
+		connection.inflight.reserve(outboxSize);
+		connection.inflightOffset = 0;
+		clientFds_.emplace(connection.clientId, fd);
+		connection.heartbeat.start((static_cast<uint64_t>(connection.generation) << 32) | static_cast<uint32_t>(fd));
+		armReceive(fd);
+
+		// Send a welcome message to the new client
+		Order welcomeMessage{};
+		welcomeMessage.clientId = connection.clientId;
+		welcomeMessage.serverRecvTs = nowNs();
+		welcomeMessage.type = 'W';
+		onReport(welcomeMessage);
+	}
+
+	void handleReceive(int fd, uint32_t generation, const io_uring_cqe& cqe)
+	{
+		HotPathScope scope("read");
+		UringConnection& connection = connections_[fd];
+		bool more = cqe.flags & IORING_CQE_F_MORE;
+		if (!more) connection.pendingOps--;
+
+		if (cqe.flags & IORING_CQE_F_BUFFER) {
+			uint16_t bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			if (cqe.res > 0 && connection.open && connection.generation == generation) {
+				connection.heartbeat.onReceive();
+				consume(fd, ring_.buffer(bufferId), static_cast<size_t>(cqe.res));
+			}
+			ring_.recycleBuffer(bufferId);
+		}
+
+		if (connection.generation != generation) return;
+		if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+			closeConnection(fd);
+		} else if (!more && connection.open) {
+			armReceive(fd); // Out of buffers (-ENOBUFS) or the kernel ended the multishot, start again
+		}
+	}
+
+	// Split the received bytes into orders, an order may straddle two receives
+	void consume(int fd, const char* data, size_t size)
+	{
+		UringConnection& connection = connections_[fd];
+		while (size > 0 && connection.open) {
+			size_t chunk = std::min(size, sizeof(Order) - connection.orderBytes);
+			std::memcpy(reinterpret_cast<char*>(&connection.order) + connection.orderBytes, data, chunk);
+			connection.orderBytes += chunk;
+			data += chunk;
+			size -= chunk;
+			if (connection.orderBytes < sizeof(Order)) break;
+
+			connection.orderBytes = 0;
+			connection.order.serverRecvTs = nowNs();
+			connection.order.clientId = connection.clientId;
+			connection.order.time = time(nullptr);
+			if (connection.order.type == 'L') login(fd);
+			else processOrder(connection.order, *this);
+		}
+	}
+
+	void handleSend(int fd, uint32_t generation, const io_uring_cqe& cqe)
+	{
+		HotPathScope scope("write");
+		UringConnection& connection = connections_[fd];
+		connection.pendingOps--;
+		if (connection.generation != generation) return;
+
+		if (cqe.res < 0) {
+			if (connection.open) std::cout << "Write error to client: " << strerror(-cqe.res) << std::endl;
+			closeConnection(fd);
+			return;
+		}
+
+		connection.inflightOffset += cqe.res;
+		if (connection.open && connection.inflightOffset < connection.inflight.size() * sizeof(Order)) {
+			armSend(fd); // Short write, send the rest
+			return;
+		}
+		connection.sending = false;
+		connection.inflight.clear();
+		connection.inflightOffset = 0;
+		if (!connection.pending.empty() && !connection.dirty) {
+			connection.dirty = true;
+			dirty_.push_back(fd);
+		}
+		if (!connection.open) closeConnection(fd); // Was waiting for this send to close the fd
+	}
+
+	// Bind the connection to the login's session, taking the session over from a connection still holding it
+	void login(int fd)
+	{
+		UringConnection& connection = connections_[fd];
+		int clientId = loginSession(connection.order, *this);
+		if (!clientId) return;
+		if (clientId != connection.clientId) {
+			onSessionClosed(connection.clientId, *this); // Orders sent before the login
+			auto previous = clientFds_.find(clientId);
+			if (previous != clientFds_.end()) {
+				cout << "Client " << clientId << " taken over by a new connection\n";
+				closeConnection(previous->second, false);
+			}
+			clientFds_.erase(connection.clientId);
+			connection.clientId = clientId;
+			clientFds_.emplace(clientId, fd);
+		}
+		completeLogin(connection.order, clientId, *this);
+	}
+
+	void handleHeartbeatTimer(uint64_t payload)
+	{
+		int fd = static_cast<int>(payload & 0xffffffff);
+		UringConnection& connection = connections_[fd];
+		if (!connection.open || connection.generation != static_cast<uint32_t>(payload >> 32)) return;
+
+		switch (connection.heartbeat.onTimer(payload)) {
+		case SessionHeartbeat::Probe:
+			onReport(heartbeatMessage(connection.clientId));
+			break;
+		case SessionHeartbeat::Expire:
+			cout << "Client " << connection.clientId << " timed out\n";
+			closeConnection(fd);
+			break;
+		case SessionHeartbeat::Wait:
+			break;
+		}
+	}
+
+	// One send per connection for everything queued since its last send
+	void flushSends()
+	{
+		HotPathScope scope("write");
+		for (int fd : dirty_) {
+			UringConnection& connection = connections_[fd];
+			connection.dirty = false;
+			if (!connection.open || connection.sending || connection.pending.empty()) continue;
+
+			connection.inflight.swap(connection.pending);
+			int64_t sendTs = nowNs();
+			for (Order& order : connection.inflight) {
+				order.serverSendTs = sendTs;
+				serverStats.egress.record(sendTs - order.serverRecvTs);
+			}
+			connection.sending = true;
+			connection.inflightOffset = 0;
+			armSend(fd);
+		}
+		dirty_.clear();
+	}
+
+	// shutdown() completes the outstanding receive/send, the fd is closed once none is left.
+	// endSession is false when a new connection takes the session over.
+	void closeConnection(int fd, bool endSession = true)
+	{
+		UringConnection& connection = connections_[fd];
+		if (connection.open) {
+			connection.open = false;
+			connection.heartbeat.stop();
+			clientFds_.erase(connection.clientId);
+			connection.pending.clear();
+			if (endSession) onSessionClosed(connection.clientId, *this);
+			shutdown(fd, SHUT_RDWR);
+		}
+		if (!connection.open && connection.pendingOps == 0) {
+			connection.generation++;
+			connection.inflight.clear();
+			close(fd);
+		}
+	}
 };
 
-int main()
+int main(int argc, char* argv[])
 {
+    // Optional: --stats <seconds> prints the server latency breakdown at that interval
+    //           --kernel-ts adds kernel RX/TX queueing time from SO_TIMESTAMPING to the breakdown
+    //           --pool-size <orders> resting orders preallocated (default 65536)
+    //           --report-pool <reports> reports queued across all connections preallocated (default 65536)
+    //           --outbox-size <reports> per connection send batch preallocated with --io-uring / --kernel-ts (default 64)
+    //           --alloc-check <orders> abort if the hot path allocates once that many orders were processed
+    //           --instrument NAME:LOWER:UPPER:TICK[:dense|bitmap][:fifo|prorata|top-prorata] adds an instrument (symbols 1, 2, ...)
+    //           --io-uring serve clients through io_uring instead of asio (falls back to asio if unavailable)
+    //           --busy-poll spin on the event loop instead of blocking, sockets get SO_BUSY_POLL
+    //           --cpu <n> pin the server thread to CPU n
+    //           --socket-buffer <bytes> SO_RCVBUF/SO_SNDBUF of accepted sockets
+    //           --backlog <connections> pending connection queue of each listening socket (default SOMAXCONN)
+    //           --acceptors <n> listening sockets sharing port 8080 through SO_REUSEPORT (default 1)
+    //           --accept-threads <n> accept on n threads, acceptors spread over them (default 0, the server thread)
+    //           --replay-depth <reports> latest reports kept in memory per logged in session for replay (default 1024)
+    //           --journal <file> also append every report of logged in sessions to file, to replay older ones
+    //           --keep-orders leave resting orders in the book when their client disconnects (default: cancel them)
+    //           --max-order-qty <n>, --max-notional <amount>, --max-open-orders <n>, --max-position <n>, --credit-limit <amount>
+    //           pre-trade risk limits of every client (default 0 = no limit)
+    //           --client-limits LOGIN:QTY:NOTIONAL:OPEN_ORDERS:POSITION:CREDIT limits of one login instead
+    //           --collar <percent> reject orders priced further than that from the instrument's last trade (default 0 = off)
+    //           --circuit-breaker <percent> halt an instrument that trades that far from its reference (default 0 = off)
+    //           --halt <seconds> length of a circuit breaker halt (default 60)
+    //           --reference SYMBOL:PRICE opening reference price of an instrument, else its first trade
+    //           --self-trade <allow|newest|oldest|both|decrement> self-trade prevention of orders that do not choose
+    //           their own: cancel the incoming order, the resting one, both, or the smaller one (default allow)
+    //           --day-end HH:MM local time day orders are cancelled at (default none, they last until cancelled)
+    //           --opening-auction <seconds> call phase every book starts with, and again after each day end (default 0 = none)
+    //           --closing-auction <seconds> call phase before the day end, uncrossed at the day end (default 0 = none)
+    //           --heartbeat <seconds> probe TCP sessions silent that long, close them after another interval (default 10, 0 = off)
+    //           --shm also accept local clients on shared memory rings (implies --busy-poll)
+    int statsInterval = 0;
+    bool useIoUring = false;
+    bool useShm = false;
+    size_t poolSize = 65536;
+    size_t reportPoolSize = 65536;
+    vector<pair<int, double>> references;
+    addInstrument("DEFAULT", lower_limit, upper_limit, tick_size, "dense");
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stats" && i + 1 < argc) statsInterval = std::atoi(argv[++i]);
+        else if (arg == "--kernel-ts") kernelTimestamps = true;
+        else if (arg == "--pool-size" && i + 1 < argc) poolSize = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--report-pool" && i + 1 < argc) reportPoolSize = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--outbox-size" && i + 1 < argc) outboxSize = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--alloc-check" && i + 1 < argc) allocCheckWarmup = std::atol(argv[++i]);
+        else if (arg == "--io-uring") useIoUring = true;
+        else if (arg == "--busy-poll") busyPoll = true;
+        else if (arg == "--shm") useShm = true;
+        else if (arg == "--cpu" && i + 1 < argc) serverCpu = std::atoi(argv[++i]);
+        else if (arg == "--socket-buffer" && i + 1 < argc) socketBufferSize = std::atoi(argv[++i]);
+        else if (arg == "--keep-orders") cancelOnDisconnect = false;
+        else if (arg == "--replay-depth" && i + 1 < argc) replayDepth = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--journal" && i + 1 < argc) journalPath = argv[++i];
+        else if (arg == "--max-order-qty" && i + 1 < argc) preTradeRisk.defaults().maxOrderQuantity = std::atoi(argv[++i]);
+        else if (arg == "--max-notional" && i + 1 < argc) preTradeRisk.defaults().maxOrderNotional = std::atof(argv[++i]);
+        else if (arg == "--max-open-orders" && i + 1 < argc) preTradeRisk.defaults().maxOpenOrders = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--max-position" && i + 1 < argc) preTradeRisk.defaults().maxPosition = std::atoll(argv[++i]);
+        else if (arg == "--credit-limit" && i + 1 < argc) preTradeRisk.defaults().creditLimit = std::atof(argv[++i]);
+        else if (arg == "--client-limits" && i + 1 < argc) {
+            if (!addClientLimits(argv[++i])) {
+                cout << "Invalid client limits " << argv[i] << ", expected LOGIN:QTY:NOTIONAL:OPEN_ORDERS:POSITION:CREDIT\n";
+                return 1;
+            }
+        }
+        else if (arg == "--collar" && i + 1 < argc) collarPercent = std::atof(argv[++i]);
+        else if (arg == "--circuit-breaker" && i + 1 < argc) breakerPercent = std::atof(argv[++i]);
+        else if (arg == "--halt" && i + 1 < argc) haltSeconds = std::atoi(argv[++i]);
+        else if (arg == "--reference" && i + 1 < argc) {
+            string spec = argv[++i];
+            size_t colon = spec.find(':');
+            if (colon == string::npos) {
+                cout << "Invalid reference " << spec << ", expected SYMBOL:PRICE\n";
+                return 1;
+            }
+            references.emplace_back(std::atoi(spec.c_str()), std::atof(spec.c_str() + colon + 1));
+        }
+        else if (arg == "--day-end" && i + 1 < argc) {
+            int hours, minutes;
+            if (std::sscanf(argv[++i], "%d:%d", &hours, &minutes) != 2 || hours < 0 || hours > 23 || minutes < 0 || minutes > 59) {
+                cout << "Invalid day end " << argv[i] << ", expected HH:MM\n";
+                return 1;
+            }
+            dayEndMinute = hours * 60 + minutes;
+        }
+        else if (arg == "--self-trade" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "allow") selfTradePrevention = SelfTradeAllow;
+            else if (mode == "newest") selfTradePrevention = SelfTradeCancelNewest;
+            else if (mode == "oldest") selfTradePrevention = SelfTradeCancelOldest;
+            else if (mode == "both") selfTradePrevention = SelfTradeCancelBoth;
+            else if (mode == "decrement") selfTradePrevention = SelfTradeDecrement;
+            else {
+                cout << "Invalid self-trade prevention " << mode << ", expected allow, newest, oldest, both or decrement\n";
+                return 1;
+            }
+        }
+        else if (arg == "--opening-auction" && i + 1 < argc) openingAuction = std::atoi(argv[++i]);
+        else if (arg == "--closing-auction" && i + 1 < argc) closingAuction = std::atoi(argv[++i]);
+        else if (arg == "--heartbeat" && i + 1 < argc) heartbeatInterval = std::atoi(argv[++i]);
+        else if (arg == "--backlog" && i + 1 < argc) listenBacklog = std::atoi(argv[++i]);
+        else if (arg == "--acceptors" && i + 1 < argc) acceptorCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--accept-threads" && i + 1 < argc) acceptThreads = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--instrument" && i + 1 < argc) {
+            if (!addInstrument(argv[++i])) {
+                cout << "Invalid instrument " << argv[i] << ", expected NAME:LOWER:UPPER:TICK[:dense|bitmap][:fifo|prorata|top-prorata]\n";
+                return 1;
+            }
+        }
+    }
+
+    restingOrders.reserve(poolSize);
+    preTradeRisk.setInstruments(static_cast<int>(books.size()));
+    for (size_t symbol = 0; symbol < books.size(); symbol++)
+        collars.emplace_back(collarPercent / 100, breakerPercent / 100, haltSeconds * 1000000000ll);
+    for (const auto& reference : references) {
+        if (reference.first < 0 || reference.first >= static_cast<int>(books.size()) || !books[reference.first]->validPrice(reference.second)) {
+            cout << "Invalid reference price " << reference.second << " for symbol " << reference.first << "\n";
+            return 1;
+        }
+        collars[reference.first].setReference(reference.second);
+    }
+    purging.assign(books.size(), 0);
+    if (dayEndMinute >= 0) {
+        nextDayEnd = dayEndAfter(time(nullptr));
+        cout << "Day orders cancelled daily at " << dayEndMinute / 60 << ":" << (dayEndMinute % 60 < 10 ? "0" : "") << dayEndMinute % 60 << "\n";
+    }
+    if (openingAuction > 0) startAuctions(time(nullptr) + openingAuction);
+    if (collarPercent > 0 || breakerPercent > 0)
+        cout << "Price collar " << collarPercent << "%, circuit breaker " << breakerPercent << "% halting for " << haltSeconds << " s\n";
+    reportChunks.reserve((reportPoolSize + ChunkedQueue<Order>::kChunkItems - 1) / ChunkedQueue<Order>::kChunkItems);
+    writeHandlerMemory.reserve(1);
+    if (!journalPath.empty()) {
+        if (!sessions.openJournal(journalPath)) {
+            cout << "Cannot open journal " << journalPath << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        cout << "Journaling reports of logged in sessions to " << journalPath << "\n";
+    }
+
+    // Every connection is a file descriptor, allow as many as the hard limit does
+    rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+
+    // The whole server (I/O and matching) is this one thread, apart from accept threads [--accept-threads]
+    if (serverCpu >= 0 && pinThread(serverCpu)) cout << "Pinned to CPU " << serverCpu << "\n";
+
+    // Shared memory rings have no readiness notification, so they are polled with the sockets
+    ShmGateway gateway;
+    if (useShm && gateway.open()) {
+        shmGateway = &gateway;
+        busyPoll = true;
+        cout << "Shared memory order entry on " << kShmName << "\n";
+    }
+
+    if (useIoUring) {
+        if (kernelTimestamps) cout << "--kernel-ts is not supported with --io-uring, ignored\n";
+        if (acceptThreads) cout << "--accept-threads is not supported with --io-uring, accepting on the server thread\n";
+        UringServer uringServer(8080, statsInterval);
+        gateway.setTcpSink(uringServer);
+        if (uringServer.start()) {
+            cout << "Serving clients through io_uring\n";
+            uringServer.run();
+            return 0;
+        }
+        cout << "Falling back to asio\n";
+    }
+
     boost::asio::io_service ioService;
 
     // Create and run the server on port 8080
-    Server server(ioService, 8080);
+    Server server(ioService, 8080, statsInterval);
+    gateway.setTcpSink(server);
 
-    // Start the IO service
+    // Start the IO service. Busy polling never blocks in epoll_wait, ready handlers run as soon as the
+    // kernel has the data, at the cost of a core at 100%.
+    if (busyPoll) {
+        cout << "Busy polling\n";
+        while (true) {
+            ioService.poll();
+            if (shmGateway) shmGateway->poll();
+        }
+    }
     ioService.run();
 
     return 0;
 }
-
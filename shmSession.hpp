@@ -0,0 +1,119 @@
+#ifndef SHM_SESSION_HPP
+#define SHM_SESSION_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "protocol.hpp"
+
+// Shared memory order entry for clients on the same host as the exchange.
+// The server creates one named segment holding kShmSlots sessions; a client claims a free slot and
+// then talks to the matching engine through two single producer / single consumer rings, orders in
+// and reports out, without any system call on either side.
+
+// Lock free ring for exactly one producer and one consumer, possibly in different processes.
+// head_ and tail_ only ever increase; each side caches the other side's index so a push or pop only
+// touches the shared cache line of the other side when the ring looks full or empty.
+template<typename T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    // Only while neither side is using the ring
+    void reset()
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+        cachedHead_ = 0;
+        cachedTail_ = 0;
+    }
+
+    // Producer side, false if the ring is full
+    bool push(const T& item)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ == N) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ == N) return false;
+        }
+        items_[tail & (N - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if the ring is empty
+    bool pop(T& item)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) return false;
+        }
+        item = items_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> head_;  // Next item to pop, written by the consumer
+    uint64_t cachedTail_;                      // Consumer's copy of tail_
+    alignas(64) std::atomic<uint64_t> tail_;  // Next free item, written by the producer
+    uint64_t cachedHead_;                      // Producer's copy of head_
+    alignas(64) T items_[N];
+};
+
+// Slot life cycle, the owner of each transition in brackets:
+// Free -> Requested [client] -> Active [server] -> Closing [client] -> Free [server]
+//                                     Active -> Dropped [server, client stopped reading] -> Free [client]
+enum ShmSlotState : uint32_t { ShmFree = 0, ShmRequested, ShmActive, ShmClosing, ShmDropped };
+
+struct ShmSlot {
+    alignas(64) std::atomic<uint32_t> state;
+    pid_t clientPid;  // Set by the client when claiming, lets the server free slots of dead clients
+    int clientId;     // Set by the server before the slot becomes Active
+    SpscRing<Order, 1024> orders;   // Client -> server
+    SpscRing<Order, 4096> reports;  // Server -> client
+};
+
+static const char* const kShmName = "/matching_engine";
+static const uint32_t kShmMagic = 0x4d454e47; // "MENG"
+static const int kShmSlots = 64;
+
+struct ShmSegment {
+    std::atomic<uint32_t> magic;  // Written last by the server, clients wait for it
+    uint32_t slotCount;
+    ShmSlot slots[kShmSlots];
+};
+
+// Map the named segment, creating (and replacing any stale one) if create is set. nullptr on failure.
+inline ShmSegment* mapShmSegment(bool create)
+{
+    if (create) shm_unlink(kShmName);
+    int fd = shm_open(kShmName, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0660);
+    if (fd < 0) return nullptr;
+    if (create && ftruncate(fd, sizeof(ShmSegment)) < 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* memory = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+
+    ShmSegment* segment = static_cast<ShmSegment*>(memory);
+    if (create) {
+        // ftruncate zero fills, which is a valid empty state for every slot and ring
+        segment->slotCount = kShmSlots;
+        segment->magic.store(kShmMagic, std::memory_order_release);
+    } else if (segment->magic.load(std::memory_order_acquire) != kShmMagic) {
+        munmap(memory, sizeof(ShmSegment));
+        return nullptr;
+    }
+    return segment;
+}
+
+#endif // SHM_SESSION_HPP
@@ -0,0 +1,146 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "memoryPool.hpp"
+
+// Hierarchical timing wheel for very many timers driven from the event loop.
+// Time is counted in ticks of whatever length the owner advances it by. Level 0 has one slot per
+// tick, every slot of level n spans a whole revolution of level n - 1, and timers are cascaded down
+// a level when their slot comes up. Scheduling and cancelling are O(1); advancing costs O(1) per
+// tick plus the timers that fire or cascade. Timers are slab allocated and linked by index, so
+// after warm-up nothing touches the heap.
+class TimerWheel {
+public:
+    typedef uint32_t TimerId;
+    static const TimerId npos = SlabPool<int>::npos;
+
+    static const int kLevelBits = 6;
+    static const int kLevels = 4;
+    static const uint32_t kSlots = 1u << kLevelBits;           // Per level
+    static const uint64_t kRange = 1ull << (kLevelBits * kLevels); // Ticks ahead the wheel covers, later timers are parked at its end
+
+    explicit TimerWheel(uint64_t now = 0) : now_(now)
+    {
+        for (TimerId& head : slots_) head = npos;
+    }
+
+    void reserve(size_t timers)
+    {
+        timers_.reserve(timers);
+    }
+
+    // Last tick advanced to
+    uint64_t now() const { return now_; }
+
+    size_t size() const { return size_; }
+
+    // Timer firing at tick expiry with payload, on the next advance if expiry is not in the future
+    TimerId schedule(uint64_t expiry, uint64_t payload)
+    {
+        TimerId id = timers_.allocate();
+        Timer& timer = timers_[id];
+        timer.expiry = expiry;
+        timer.payload = payload;
+        link(id, now_ + 1);
+        size_++;
+        return id;
+    }
+
+    // Only for timers that have not fired yet
+    void cancel(TimerId id)
+    {
+        unlink(id);
+        timers_.release(id);
+        size_--;
+    }
+
+    void reschedule(TimerId id, uint64_t expiry)
+    {
+        unlink(id);
+        timers_[id].expiry = expiry;
+        link(id, now_ + 1);
+    }
+
+    // Move time forward to tick now, calling handler(uint64_t payload) for every timer that expires on
+    // the way, tick by tick. A timer is gone by the time its handler runs; the handler may schedule
+    // and cancel others, timers it schedules at or before the current tick fire on the next tick.
+    template<typename Handler>
+    void advance(uint64_t now, Handler&& handler)
+    {
+        while (now_ < now) {
+            if (size_ == 0) {
+                now_ = now;
+                return;
+            }
+            now_++;
+            // Pull the next slot of every level whose lower level just completed a revolution
+            for (int level = 1; level < kLevels && (now_ & ((1ull << (kLevelBits * level)) - 1)) == 0; level++)
+                cascade(level);
+
+            TimerId& head = slots_[now_ & (kSlots - 1)];
+            while (head != npos) {
+                TimerId id = head;
+                uint64_t payload = timers_[id].payload;
+                unlink(id);
+                timers_.release(id);
+                size_--;
+                handler(payload);
+            }
+        }
+    }
+
+private:
+    struct Timer {
+        uint64_t expiry;
+        uint64_t payload;
+        TimerId prev;
+        TimerId next;
+        uint32_t slot;  // Index into slots_, level * kSlots + slot
+    };
+
+    SlabPool<Timer> timers_;
+    TimerId slots_[kLevels * kSlots];  // Head of each slot's doubly linked list
+    uint64_t now_;
+    size_t size_ = 0;
+
+    // Into the slot of its expiry, or of tick earliest if that has passed already
+    void link(TimerId id, uint64_t earliest)
+    {
+        Timer& timer = timers_[id];
+        uint64_t expiry = timer.expiry > earliest ? timer.expiry : earliest;
+        if (expiry - now_ >= kRange) expiry = now_ + kRange - 1; // Parked, re-placed when cascaded
+        int level = 0;
+        while (level < kLevels - 1 && expiry - now_ >= (1ull << (kLevelBits * (level + 1)))) level++;
+        timer.slot = level * kSlots + static_cast<uint32_t>((expiry >> (kLevelBits * level)) & (kSlots - 1));
+
+        TimerId& head = slots_[timer.slot];
+        timer.prev = npos;
+        timer.next = head;
+        if (head != npos) timers_[head].prev = id;
+        head = id;
+    }
+
+    void unlink(TimerId id)
+    {
+        Timer& timer = timers_[id];
+        if (timer.prev != npos) timers_[timer.prev].next = timer.next;
+        else slots_[timer.slot] = timer.next;
+        if (timer.next != npos) timers_[timer.next].prev = timer.prev;
+    }
+
+    void cascade(int level)
+    {
+        TimerId& head = slots_[level * kSlots + ((now_ >> (kLevelBits * level)) & (kSlots - 1))];
+        TimerId id = head;
+        head = npos;
+        while (id != npos) {
+            TimerId next = timers_[id].next;
+            link(id, now_); // The slot of now_ is yet to fire
+            id = next;
+        }
+    }
+};
+
+#endif // TIMER_WHEEL_HPP